@@ -0,0 +1,628 @@
+/* Copyright 2019
+ * Kaz Kylheku <kaz@kylheku.com>
+ * Vancouver, Canada
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+#include <signal.h>
+#include <errno.h>
+#include "config.h"
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include "lib.h"
+#include "gc.h"
+#include "args.h"
+#include "signal.h"
+#include "unwind.h"
+#include "stream.h"
+#include "arith.h"
+#include "utf8.h"
+#include "itypes.h"
+#include "hash.h"
+#include "parser.h"
+#include "eval.h"
+#include "cadr.h"
+#include "cdb.h"
+
+/*
+ * Constant database file format.
+ *
+ * All integers are 32 bit little endian, so the file is limited to 4 GiB.
+ *
+ *   header   magic[8] nslots count table check reserved[8]
+ *   records  ktag vtag 0 0 klen vlen key-bytes NUL value-bytes NUL
+ *   table    nslots pairs of: hash record-offset
+ *
+ * Records start right after the header and run up to the table.
+ * Keys are strings (UTF-8) or integers (decimal text); values may also
+ * be arbitrary printed objects which are read back with the Lisp reader.
+ * The table is open addressed with linear probing, and is never more
+ * than half full; a zero offset marks an empty slot. The check field
+ * holds the hash of a fixed key, so that a file built by a TXR whose
+ * equal_hash differs from ours is rejected rather than silently
+ * failing every lookup.
+ */
+
+#define CDB_MAGIC "TXRCDB01"
+#define CDB_HDR_SIZE 32
+#define CDB_REC_SIZE 12
+#define CDB_SLOT_SIZE 8
+#define CDB_MAX 0xFFFFFFFFUL
+
+enum cdb_tag { CDB_STR = 's', CDB_INT = 'i', CDB_OBJ = 'o' };
+
+struct cdb {
+  const unsigned char *base;
+  ucnum size;
+  ucnum nslots, count, table;
+  int mapped;
+  val path;
+};
+
+struct cdb_iter {
+  val cdb;
+  ucnum off;
+};
+
+val cdb_s;
+
+static void cdb_put32(unsigned char *p, ucnum x)
+{
+  p[0] = x & 0xff;
+  p[1] = (x >> 8) & 0xff;
+  p[2] = (x >> 16) & 0xff;
+  p[3] = (x >> 24) & 0xff;
+}
+
+static ucnum cdb_get32(const unsigned char *p)
+{
+  return convert(ucnum, p[0]) | convert(ucnum, p[1]) << 8 |
+         convert(ucnum, p[2]) << 16 | convert(ucnum, p[3]) << 24;
+}
+
+static u32_t cdb_hash(val key)
+{
+  int lim = 32;
+  return equal_hash(key, &lim, 0) & CDB_MAX;
+}
+
+static u32_t cdb_check(void)
+{
+  return cdb_hash(list(lit(CDB_MAGIC), expt(two, num_fast(100)), nao));
+}
+
+static val cdb_text(val obj, int *tag, int any)
+{
+  switch (type(obj)) {
+  case LIT:
+  case STR:
+  case LSTR:
+    *tag = CDB_STR;
+    return obj;
+  case NUM:
+  case BGNUM:
+    *tag = CDB_INT;
+    return tostring(obj);
+  default:
+    if (!any) {
+      return nil;
+    } else {
+      val text = tostring(obj);
+      *tag = CDB_OBJ;
+      if (lisp_parse(text, std_null, colon_k, lit("cdb-build"),
+                     colon_k) == colon_k)
+        return nil;
+      return text;
+    }
+  }
+}
+
+static unsigned char *cdb_bytes(val text, size_t *plen)
+{
+  unsigned char *bytes = utf8_dup_to_buf(c_str(text), plen, 1);
+  --*plen;
+  return bytes;
+}
+
+static void cdb_release(struct cdb *db)
+{
+  if (db->base) {
+#if HAVE_MMAP
+    if (db->mapped)
+      munmap(coerce(void *, db->base), db->size);
+    else
+#endif
+      free(coerce(mem_t *, db->base));
+    db->base = 0;
+  }
+}
+
+static void cdb_destroy(val obj)
+{
+  struct cdb *db = coerce(struct cdb *, obj->co.handle);
+  cdb_release(db);
+  free(db);
+}
+
+static void cdb_mark(val obj)
+{
+  struct cdb *db = coerce(struct cdb *, obj->co.handle);
+  gc_mark(db->path);
+}
+
+static void cdb_print_op(val obj, val out, val pretty, struct strm_ctx *ctx)
+{
+  struct cdb *db = coerce(struct cdb *, obj->co.handle);
+  put_string(lit("#<cdb "), out);
+  obj_print_impl(db->path, out, pretty, ctx);
+  if (!db->base)
+    put_string(lit(" closed"), out);
+  put_char(chr('>'), out);
+}
+
+static struct cobj_ops cdb_ops = cobj_ops_init(eq,
+                                               cdb_print_op,
+                                               cdb_destroy,
+                                               cdb_mark,
+                                               cobj_eq_hash_op);
+
+static struct cdb *cdb_handle(val self, val obj)
+{
+  struct cdb *db = coerce(struct cdb *, cobj_handle(self, obj, cdb_s));
+
+  if (!db->base)
+    uw_throwf(error_s, lit("~a: ~s is closed"), self, obj, nao);
+
+  return db;
+}
+
+static void cdb_corrupt(val self, struct cdb *db)
+{
+  uw_throwf(error_s, lit("~a: ~a is not a valid cdb file"),
+            self, db->path, nao);
+}
+
+/*
+ * Returns the record at off, or null if it doesn't lie wholly within
+ * the record area. Doesn't throw, so callers can release resources first.
+ */
+static const unsigned char *cdb_record(struct cdb *db, ucnum off)
+{
+  const unsigned char *rec = db->base + off;
+  ucnum avail;
+
+  if (off < CDB_HDR_SIZE || off > db->table ||
+      (avail = db->table - off) < CDB_REC_SIZE)
+    return 0;
+
+  avail -= CDB_REC_SIZE;
+
+  if (cdb_get32(rec + 4) >= avail)
+    return 0;
+
+  avail -= cdb_get32(rec + 4) + 1;
+
+  if (cdb_get32(rec + 8) >= avail)
+    return 0;
+
+  return rec;
+}
+
+static val cdb_decode(val self, struct cdb *db, int tag,
+                      const unsigned char *bytes, ucnum len)
+{
+  val text = string_own(utf8_dup_from_buf(coerce(const char *, bytes), len));
+
+  switch (tag) {
+  case CDB_STR:
+    return text;
+  case CDB_INT:
+    return int_str(text, nil);
+  case CDB_OBJ:
+    {
+      val obj = lisp_parse(text, std_null, colon_k, db->path, colon_k);
+      if (obj != colon_k)
+        return obj;
+    }
+    /* fallthrough */
+  default:
+    cdb_corrupt(self, db);
+    abort();
+  }
+}
+
+static val cdb_rec_key(val self, struct cdb *db, const unsigned char *rec)
+{
+  return cdb_decode(self, db, rec[0], rec + CDB_REC_SIZE, cdb_get32(rec + 4));
+}
+
+static val cdb_rec_value(val self, struct cdb *db, const unsigned char *rec)
+{
+  ucnum klen = cdb_get32(rec + 4);
+  return cdb_decode(self, db, rec[1], rec + CDB_REC_SIZE + klen + 1,
+                    cdb_get32(rec + 8));
+}
+
+static const unsigned char *cdb_find(val self, struct cdb *db, val key)
+{
+  int tag;
+  val text = cdb_text(key, &tag, 0);
+  u32_t hv;
+  ucnum mask = db->nslots - 1, i, n;
+  const unsigned char *found = 0;
+  unsigned char *bytes;
+  size_t len;
+
+  if (!text)
+    return 0;
+
+  hv = cdb_hash(key);
+  bytes = cdb_bytes(text, &len);
+
+  for (i = hv & mask, n = 0; n < db->nslots; i = (i + 1) & mask, n++) {
+    const unsigned char *slot = db->base + db->table + CDB_SLOT_SIZE * i;
+    ucnum off = cdb_get32(slot + 4);
+    const unsigned char *rec;
+
+    if (off == 0)
+      break;
+
+    if (cdb_get32(slot) != hv)
+      continue;
+
+    if ((rec = cdb_record(db, off)) == 0) {
+      free(bytes);
+      cdb_corrupt(self, db);
+    }
+
+    if (rec[0] == tag && cdb_get32(rec + 4) == len &&
+        memcmp(rec + CDB_REC_SIZE, bytes, len) == 0)
+    {
+      found = rec;
+      break;
+    }
+  }
+
+  free(bytes);
+  return found;
+}
+
+static val cdb_pairs_hash(val pairs)
+{
+  val hash = make_hash(nil, nil, t);
+
+  for (pairs = nullify(pairs); pairs; pairs = cdr(pairs)) {
+    val pair = car(pairs);
+    sethash(hash, car(pair), cadr(pair));
+  }
+
+  return hash;
+}
+
+static void cdb_write_error(val self, val path)
+{
+  uw_throwf(file_error_s, lit("~a: error writing ~a: ~d/~s"),
+            self, path, num(errno), string_utf8(strerror(errno)), nao);
+}
+
+static void cdb_write(val self, FILE *f, const unsigned char *data,
+                      size_t size, val path)
+{
+  if (fwrite(data, 1, size, f) != size)
+    cdb_write_error(self, path);
+}
+
+val cdb_build(val path, val source)
+{
+  val self = lit("cdb-build");
+  val hash = if3(hashp(source), source, cdb_pairs_hash(source));
+  ucnum count = c_unum(hash_count(hash));
+  ucnum nslots = 8, mask, off = CDB_HDR_SIZE;
+  unsigned char hdr[CDB_HDR_SIZE] = { 0 };
+  unsigned char *slots;
+  FILE *f;
+
+  if (count > CDB_MAX / 4)
+    uw_throwf(error_s, lit("~a: too many entries"), self, nao);
+
+  while (nslots < 2 * count)
+    nslots *= 2;
+
+  mask = nslots - 1;
+
+  if ((f = w_fopen(c_str(path), L"wb")) == 0)
+    uw_throwf(file_error_s, lit("~a: error opening ~a: ~d/~s"),
+              self, path, num(errno), string_utf8(strerror(errno)), nao);
+
+  slots = coerce(unsigned char *, chk_calloc(nslots, CDB_SLOT_SIZE));
+
+  uw_simple_catch_begin;
+
+  {
+    val iter = hash_begin(hash), cell;
+
+    cdb_write(self, f, hdr, sizeof hdr, path);
+
+    while ((cell = hash_next(iter)) != nil) {
+      val key = us_car(cell);
+      int ktag, vtag;
+      val ktext = cdb_text(key, &ktag, 0);
+      val vtext = cdb_text(us_cdr(cell), &vtag, 1);
+      unsigned char rec[CDB_REC_SIZE] = { 0 };
+      unsigned char *kbytes, *vbytes;
+      size_t klen, vlen;
+      u32_t hv;
+      ucnum i;
+
+      if (!ktext)
+        uw_throwf(error_s, lit("~a: key ~s isn't a string or integer"),
+                  self, key, nao);
+
+      if (!vtext)
+        uw_throwf(error_s, lit("~a: value ~s of key ~s can't be read back"),
+                  self, us_cdr(cell), key, nao);
+
+      kbytes = cdb_bytes(ktext, &klen);
+      vbytes = cdb_bytes(vtext, &vlen);
+
+      if (CDB_MAX - off < CDB_REC_SIZE + klen + vlen + 2 +
+          CDB_SLOT_SIZE * nslots)
+      {
+        free(kbytes);
+        free(vbytes);
+        uw_throwf(error_s, lit("~a: data exceeds the 4 GiB limit"), self, nao);
+      }
+
+      rec[0] = ktag;
+      rec[1] = vtag;
+      cdb_put32(rec + 4, klen);
+      cdb_put32(rec + 8, vlen);
+
+      if (fwrite(rec, 1, sizeof rec, f) != sizeof rec ||
+          fwrite(kbytes, 1, klen + 1, f) != klen + 1 ||
+          fwrite(vbytes, 1, vlen + 1, f) != vlen + 1)
+      {
+        free(kbytes);
+        free(vbytes);
+        cdb_write_error(self, path);
+      }
+
+      free(kbytes);
+      free(vbytes);
+
+      hv = cdb_hash(key);
+
+      for (i = hv & mask; cdb_get32(slots + CDB_SLOT_SIZE * i + 4) != 0;
+           i = (i + 1) & mask)
+        ; /* empty */
+
+      cdb_put32(slots + CDB_SLOT_SIZE * i, hv);
+      cdb_put32(slots + CDB_SLOT_SIZE * i + 4, off);
+
+      off += CDB_REC_SIZE + klen + vlen + 2;
+    }
+
+    cdb_write(self, f, slots, CDB_SLOT_SIZE * nslots, path);
+
+    memcpy(hdr, CDB_MAGIC, 8);
+    cdb_put32(hdr + 8, nslots);
+    cdb_put32(hdr + 12, count);
+    cdb_put32(hdr + 16, off);
+    cdb_put32(hdr + 20, cdb_check());
+
+    if (fseek(f, 0, SEEK_SET) != 0)
+      cdb_write_error(self, path);
+
+    cdb_write(self, f, hdr, sizeof hdr, path);
+
+    if (fflush(f) != 0)
+      cdb_write_error(self, path);
+  }
+
+  uw_unwind {
+    fclose(f);
+    free(slots);
+  }
+
+  uw_catch_end;
+
+  return unum(count);
+}
+
+val cdb_open(val path)
+{
+  val self = lit("cdb-open");
+  FILE *f = w_fopen(c_str(path), L"rb");
+  struct cdb *db;
+  val obj;
+  long size;
+
+  if (!f)
+    uw_throwf(file_error_s, lit("~a: error opening ~a: ~d/~s"),
+              self, path, num(errno), string_utf8(strerror(errno)), nao);
+
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+    int eno = errno;
+    fclose(f);
+    uw_throwf(file_error_s, lit("~a: cannot determine size of ~a: ~d/~s"),
+              self, path, num(eno), string_utf8(strerror(eno)), nao);
+  }
+
+  db = coerce(struct cdb *, chk_calloc(1, sizeof *db));
+  db->path = path;
+  obj = cobj(coerce(mem_t *, db), cdb_s, &cdb_ops);
+
+  if (size < CDB_HDR_SIZE || convert(ucnum, size) > CDB_MAX) {
+    fclose(f);
+    cdb_corrupt(self, db);
+  }
+
+  db->size = size;
+
+#if HAVE_MMAP
+  {
+    void *addr = mmap(0, size, PROT_READ, MAP_SHARED, fileno(f), 0);
+
+    if (addr != MAP_FAILED) {
+      db->base = coerce(const unsigned char *, addr);
+      db->mapped = 1;
+    }
+  }
+#endif
+
+  if (!db->base) {
+    unsigned char *data = coerce(unsigned char *, chk_malloc(size));
+
+    if (fseek(f, 0, SEEK_SET) != 0 || fread(data, 1, size, f) != convert(size_t, size)) {
+      int eno = errno;
+      free(data);
+      fclose(f);
+      uw_throwf(file_error_s, lit("~a: error reading ~a: ~d/~s"),
+                self, path, num(eno), string_utf8(strerror(eno)), nao);
+    }
+
+    db->base = data;
+  }
+
+  fclose(f);
+
+  if (memcmp(db->base, CDB_MAGIC, 8) != 0)
+    cdb_corrupt(self, db);
+
+  db->nslots = cdb_get32(db->base + 8);
+  db->count = cdb_get32(db->base + 12);
+  db->table = cdb_get32(db->base + 16);
+
+  if (db->nslots == 0 || (db->nslots & (db->nslots - 1)) != 0 ||
+      db->count >= db->nslots || db->table < CDB_HDR_SIZE ||
+      db->table > db->size ||
+      (db->size - db->table) / CDB_SLOT_SIZE < db->nslots)
+    cdb_corrupt(self, db);
+
+  if (cdb_get32(db->base + 20) != cdb_check())
+    uw_throwf(error_s, lit("~a: ~a was built with an incompatible hash function"),
+              self, path, nao);
+
+  return obj;
+}
+
+val cdb_close(val cdb)
+{
+  val self = lit("cdb-close");
+  struct cdb *db = coerce(struct cdb *, cobj_handle(self, cdb, cdb_s));
+  val was_open = tnil(db->base);
+  cdb_release(db);
+  return was_open;
+}
+
+val cdbp(val obj)
+{
+  return typeof(obj) == cdb_s ? t : nil;
+}
+
+val cdb_count(val cdb)
+{
+  val self = lit("cdb-count");
+  return unum(cdb_handle(self, cdb)->count);
+}
+
+val cdb_get(val cdb, val key, val notfound_val)
+{
+  val self = lit("cdb-get");
+  struct cdb *db = cdb_handle(self, cdb);
+  const unsigned char *rec = cdb_find(self, db, key);
+  return if3(rec, cdb_rec_value(self, db, rec), default_null_arg(notfound_val));
+}
+
+static void cdb_iter_mark(val iter)
+{
+  struct cdb_iter *ci = coerce(struct cdb_iter *, iter->co.handle);
+  gc_mark(ci->cdb);
+}
+
+static struct cobj_ops cdb_iter_ops = cobj_ops_init(eq,
+                                                    cobj_print_op,
+                                                    cobj_destroy_free_op,
+                                                    cdb_iter_mark,
+                                                    cobj_eq_hash_op);
+
+/*
+ * Like hamt iterators, cdb iterators have the class of a hash iterator;
+ * hash-begin and hash-next dispatch here. They walk the records in
+ * file order, producing fresh (key . value) conses.
+ */
+val cdb_begin(val cdb)
+{
+  val self = lit("hash-begin");
+  struct cdb_iter *ci;
+
+  (void) cdb_handle(self, cdb);
+  ci = coerce(struct cdb_iter *, chk_malloc(sizeof *ci));
+  ci->cdb = cdb;
+  ci->off = CDB_HDR_SIZE;
+  return cobj(coerce(mem_t *, ci), hash_iter_s, &cdb_iter_ops);
+}
+
+int cdb_iter_p(val iter)
+{
+  return iter->co.ops == &cdb_iter_ops;
+}
+
+val cdb_next(val iter)
+{
+  val self = lit("hash-next");
+  struct cdb_iter *ci = coerce(struct cdb_iter *, iter->co.handle);
+  struct cdb *db = cdb_handle(self, ci->cdb);
+  const unsigned char *rec;
+  val key;
+
+  if (ci->off >= db->table)
+    return nil;
+
+  if ((rec = cdb_record(db, ci->off)) == 0)
+    cdb_corrupt(self, db);
+
+  ci->off += CDB_REC_SIZE + cdb_get32(rec + 4) + cdb_get32(rec + 8) + 2;
+  key = cdb_rec_key(self, db, rec);
+  return cons(key, cdb_rec_value(self, db, rec));
+}
+
+void cdb_init(void)
+{
+  cdb_s = intern(lit("cdb"), user_package);
+
+  reg_fun(intern(lit("cdb-build"), user_package), func_n2(cdb_build));
+  reg_fun(intern(lit("cdb-open"), user_package), func_n1(cdb_open));
+  reg_fun(intern(lit("cdb-close"), user_package), func_n1(cdb_close));
+  reg_fun(intern(lit("cdbp"), user_package), func_n1(cdbp));
+  reg_fun(intern(lit("cdb-count"), user_package), func_n1(cdb_count));
+  reg_fun(intern(lit("cdb-get"), user_package), func_n3o(cdb_get, 2));
+}
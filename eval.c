@@ -1413,8 +1413,12 @@ val funcall_interp(val interp_fun, struct args *args)
   val params = car(def);
   val body = cdr(def);
   val saved_de = dyn_env;
+  struct prof_frame pf;
   val fun_env = bind_args(env, params, args, interp_fun);
-  val ret = eval_progn(body, fun_env, body);
+  val ret;
+  prof_frame_push(&pf, interp_fun, fun, 0);
+  ret = eval_progn(body, fun_env, body);
+  prof_frame_pop(&pf);
   dyn_env = saved_de;
   return ret;
 }
@@ -27,29 +27,53 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <wchar.h>
 #include <signal.h>
+#include <sys/time.h>
 #include "config.h"
+#if HAVE_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif
 #if HAVE_VALGRIND
 #include <valgrind/memcheck.h>
 #endif
 #include "lib.h"
 #include "stream.h"
 #include "hash.h"
+#include "arith.h"
 #include "txr.h"
 #include "eval.h"
 #include "gc.h"
 #include "signal.h"
+#include "unwind.h"
 
 #define PROT_STACK_SIZE         1024
-#define HEAP_SIZE               16384
-#define CHECKOBJ_VEC_SIZE       (2 * HEAP_SIZE)
-#define MUTOBJ_VEC_SIZE         (2 * HEAP_SIZE)
+#define HEAP_ARENA_SHIFT        19
+#define HEAP_ARENA_SIZE         (convert(uint_ptr_t, 1) << HEAP_ARENA_SHIFT)
+#define ARENA_GROUP             8
+#define ARENA_CELLS(T)          convert(int, (HEAP_ARENA_SIZE -          \
+                                              sizeof (union arena_hdr)) / \
+                                             sizeof (T))
+#define HEAP_SIZE               ARENA_CELLS(obj_t)
+#define CONS_HEAP_SIZE          ARENA_CELLS(struct cons)
+#define ARENA_MAP_INIT_SIZE     64
+#define MARK_GRANULE            (2 * sizeof (val))
+#define BITMAP_WORDS            (HEAP_ARENA_SIZE / MARK_GRANULE / PTR_BIT)
 #define FULL_GC_INTERVAL        40
 #define FRESHOBJ_VEC_SIZE       (8 * HEAP_SIZE)
+#define MARK_STACK_INIT_SIZE    4096
+#define MARK_PENDING            0x400
+#define MARK_INCR_ALLOC_STEP    1024
+#define MARK_INCR_CHECK         256
+#define PAUSE_BUCKETS           24
+#define PROF_DEPTH              32
+#define PROF_TAB_INIT_SIZE      256
 #define DFL_MALLOC_DELTA_THRESH (64L * 1024 * 1024)
+#define DFL_HEAP_SLACK          100
 
 #if __aarch64__
 #define STACK_TOP_EXTRA_WORDS 4
@@ -57,11 +81,61 @@
 #define STACK_TOP_EXTRA_WORDS 0
 #endif
 
+/*
+ * Each heap's objects are allocated in an arena of HEAP_ARENA_SIZE bytes,
+ * aligned on a HEAP_ARENA_SIZE boundary. The arena containing any address
+ * is found by masking, and whether that arena belongs to a heap is decided
+ * by a lookup in arena_map, so that conservatively scanned words are
+ * validated in constant time regardless of how many heaps there are.
+ * The first object-sized slot of the arena points back to the heap, so that
+ * the heap of a known-valid object is found without the lookup.
+ *
+ * Every heap belongs to a pool, which determines the size of its cells and
+ * has its own free list. Conses, by far the most numerous objects, come from
+ * a pool whose cells are only the size of a struct cons; everything else is
+ * allocated from the pool of full-sized obj_t cells. The per-heap bitmaps
+ * have a bit for every MARK_GRANULE bytes of the arena, which is finer than
+ * the smallest cell, so each cell has a bit of its own.
+ *
+ * A full collection counts the marked objects in each heap. Heaps in which
+ * nothing was marked are retired when they are swept: their objects are
+ * finalized, but not put on the free list. Once sweeping is complete, the
+ * retired heaps are unmapped, returning their memory to the system. Each
+ * pool keeps a number of completely free heaps as slack, so that a program
+ * whose heap usage oscillates does not repeatedly release and reacquire
+ * memory; see sweep_plan_release.
+ */
+struct pool {
+  val free_list, *free_tail;
+  size_t cell;
+  int size;
+  cnum heaps;
+  int exhausted;
+  int_ptr_t freed;
+  cnum marked;
+  cnum release;
+};
+
 typedef struct heap {
   struct heap *next;
-  obj_t block[HEAP_SIZE];
+  struct pool *pool;
+  obj_t *block, *end;
+  mem_t *alloc;
+  cnum marked;
+  int retired;
+  ucnum marks[BITMAP_WORDS];
+#if CONFIG_GEN_GC
+  struct heap *dirty_next;
+  int dirty_listed;
+  ucnum dirty[BITMAP_WORDS];
+#endif
 } heap_t;
 
+union arena_hdr {
+  heap_t *heap;
+  obj_t align;
+};
+
 typedef struct mach_context {
   struct jmp buf;
 } mach_context_t;
@@ -69,6 +143,10 @@ typedef struct mach_context {
 #define save_context(X) jmp_save(&(X).buf)
 
 int opt_gc_debug;
+int opt_gc_lazy_sweep;
+int opt_gc_log;
+ucnum opt_gc_pause_budget;
+cnum opt_gc_heap_slack = DFL_HEAP_SLACK;
 #if HAVE_VALGRIND
 int opt_vg_debug;
 #endif
@@ -78,9 +156,21 @@ static val *prot_stack[PROT_STACK_SIZE];
 static val **prot_stack_limit = prot_stack + PROT_STACK_SIZE;
 val **gc_prot_top = prot_stack;
 
-static val free_list, *free_tail = &free_list;
+enum { OBJ_POOL, CONS_POOL, NUM_POOLS };
+
+static struct pool pools[NUM_POOLS] = {
+  { 0, &pools[OBJ_POOL].free_list, sizeof (obj_t), HEAP_SIZE,
+    0, 0, 0, 0, 0 },
+  { 0, &pools[CONS_POOL].free_list, sizeof (struct cons), CONS_HEAP_SIZE,
+    0, 0, 0, 0, 0 }
+};
+
 static heap_t *heap_list;
 static val heap_min_bound, heap_max_bound;
+static cnum heaps_retired;
+
+static heap_t **arena_map;
+static ucnum arena_map_mask, arena_map_count;
 
 alloc_bytes_t gc_bytes;
 static alloc_bytes_t prev_malloc_bytes;
@@ -89,6 +179,67 @@ alloc_bytes_t opt_gc_delta = DFL_MALLOC_DELTA_THRESH;
 int gc_enabled = 1;
 static int inprogress;
 
+static val *mark_stack;
+static cnum mark_stack_size, mark_stack_top;
+static cnum mark_pending;
+static int mark_draining;
+
+static heap_t *sweep_next;
+static int mark_bitmap;
+
+static struct gc_stats {
+  ucnum collections, time, last_time;
+  alloc_bytes_t last_delta;
+  ucnum heaps_added, heaps_released, finals;
+  ucnum freed[MAXTYPE + 1], retained[MAXTYPE + 1];
+} gc_stat;
+
+/*
+ * Allocation profiler. When alloc_prof_period is nonzero, a sample is taken
+ * whenever that many bytes have been allocated in objects or through
+ * chk_malloc. A sample captures up to PROF_DEPTH innermost frames of the
+ * prof_top chain; samples with the same frames are aggregated into one site,
+ * which accumulates the sampled bytes by object type. The type of a sampled
+ * object is known only once make_obj has returned and the caller has
+ * initialized it, so it is resolved in the next make_obj call.
+ * A site identifies its frames by code and ip, which it keeps alive. It
+ * does not keep the functions alive: a function which becomes garbage is
+ * replaced with lambda_s by prof_weak before the sweep, and is reported
+ * as an anonymous function.
+ */
+struct prof_site {
+  ucnum hash;
+  int depth;
+  struct prof_frame frame[PROF_DEPTH];
+  ucnum samples;
+  ucnum bytes[MAXTYPE + 2];
+};
+
+#define PROF_MALLOC (MAXTYPE + 1)
+
+ucnum alloc_prof_period;
+struct prof_frame *prof_top;
+static cnum prof_left;
+static int prof_busy;
+static struct prof_site **prof_tab;
+static ucnum prof_tab_mask, prof_tab_count;
+
+static struct {
+  struct prof_site *site;
+  ucnum bytes;
+  val obj;
+} prof_pend;
+
+static struct gc_pauses {
+  ucnum count, total, max;
+  ucnum hist[PAUSE_BUCKETS];
+} gc_pauses;
+
+static void sweep_lazy_step(void);
+#if CONFIG_GEN_GC
+static void mark_incr_step(void);
+#endif
+
 static struct fin_reg {
   struct fin_reg *next;
   val obj;
@@ -97,13 +248,44 @@ static struct fin_reg {
 } *final_list, **final_tail = &final_list;
 
 #if CONFIG_GEN_GC
-static val checkobj[CHECKOBJ_VEC_SIZE];
-static int checkobj_idx;
-static val mutobj[MUTOBJ_VEC_SIZE];
-static int mutobj_idx;
+/*
+ * The remembered set consists of a bitmap in each heap, flagging the mature
+ * objects which have been mutated to point to baby objects since the last
+ * collection. Heaps with any such objects are chained on dirty_heaps.
+ */
+static heap_t *dirty_heaps;
 static val freshobj[FRESHOBJ_VEC_SIZE];
 static int freshobj_idx;
 int full_gc;
+
+/*
+ * When opt_gc_pause_budget is nonzero, a full collection is performed as an
+ * incremental marking cycle. The first increment only pushes the registered
+ * roots. After that, every MARK_INCR_ALLOC_STEP allocations, the mark stack
+ * is drained for at most opt_gc_pause_budget microseconds. Objects allocated
+ * during the cycle are recorded in freshobj but not marked; the write
+ * barrier shades the objects stored into marked objects, and re-queues
+ * marked objects reported by gc_mutated. When the mark stack runs dry, the
+ * cycle is completed with a pause which marks the roots, the stack and the
+ * objects in freshobj, and sweeps lazily.
+ */
+static int mark_incr;
+static int mark_incr_countdown;
+
+/*
+ * During an incremental cycle, every new object must be recorded, even when
+ * freshobj is full and the cycle cannot be completed because gc_enabled is
+ * off. The excess goes into this growable vector.
+ */
+static val *freshobj_ovf;
+static ucnum freshobj_ovf_count, freshobj_ovf_size;
+
+static struct gc_counters {
+  ucnum minor, full;
+  ucnum barrier_set, barrier_mut, dirty_scanned;
+  ucnum full_delta, full_interval, full_fresh, full_final;
+  ucnum incr_steps;
+} gc_cnt;
 #endif
 
 #if CONFIG_EXTRA_DEBUGGING
@@ -132,13 +314,248 @@ void protect(val *first, ...)
   va_end (vl);
 }
 
-static void more(void)
+INLINE ucnum arena_key(const void *ptr)
+{
+  return coerce(uint_ptr_t, ptr) >> HEAP_ARENA_SHIFT;
+}
+
+INLINE ucnum arena_hash(ucnum key)
+{
+  return key ^ (key >> 7) ^ (key >> 13);
+}
+
+INLINE heap_t *heap_of(val obj)
+{
+  uint_ptr_t base = coerce(uint_ptr_t, obj) & ~(HEAP_ARENA_SIZE - 1);
+  return coerce(union arena_hdr *, base)->heap;
+}
+
+INLINE cnum granule_of(val obj)
 {
+  return (coerce(uint_ptr_t, obj) & (HEAP_ARENA_SIZE - 1)) / MARK_GRANULE;
+}
+
+INLINE val heap_succ(val obj, size_t cell)
+{
+  return coerce(val, coerce(mem_t *, obj) + cell);
+}
+
+INLINE size_t heap_bytes(heap_t *heap)
+{
+  return coerce(mem_t *, heap->end) - coerce(mem_t *, heap->block);
+}
+
+static void arena_map_insert(heap_t *heap)
+{
+  ucnum i;
+
+  if (2 * (arena_map_count + 1) > arena_map_mask + 1 || !arena_map) {
+    ucnum old_size = arena_map ? arena_map_mask + 1 : 0;
+    ucnum new_size = old_size ? 2 * old_size : ARENA_MAP_INIT_SIZE;
+    heap_t **old_map = arena_map;
+    ucnum j;
+
+    arena_map = coerce(heap_t **, chk_calloc(new_size, sizeof *arena_map));
+    arena_map_mask = new_size - 1;
+
+    for (j = 0; j < old_size; j++) {
+      heap_t *h = old_map[j];
+      if (h) {
+        for (i = arena_hash(arena_key(h->block)) & arena_map_mask;
+             arena_map[i] != 0;
+             i = (i + 1) & arena_map_mask)
+          ; /* empty */
+        arena_map[i] = h;
+      }
+    }
+
+    free(old_map);
+  }
+
+  for (i = arena_hash(arena_key(heap->block)) & arena_map_mask;
+       arena_map[i] != 0;
+       i = (i + 1) & arena_map_mask)
+    ; /* empty */
+
+  arena_map[i] = heap;
+  arena_map_count++;
+}
+
+static heap_t *arena_lookup(val ptr)
+{
+  ucnum key = arena_key(ptr);
+  ucnum i = arena_hash(key) & arena_map_mask;
+  heap_t *heap;
+
+  while ((heap = arena_map[i]) != 0) {
+    if (arena_key(heap->block) == key)
+      return heap;
+    i = (i + 1) & arena_map_mask;
+  }
+
+  return 0;
+}
+
+static void arena_map_remove(heap_t *heap)
+{
+  ucnum i = arena_hash(arena_key(heap->block)) & arena_map_mask;
+  ucnum j;
+
+  while (arena_map[i] != heap)
+    i = (i + 1) & arena_map_mask;
+
+  arena_map[i] = 0;
+  arena_map_count--;
+
+  /* Close the gap: move back any following entry of the same cluster
+     whose home slot does not lie cyclically in (i, j]. */
+  for (j = (i + 1) & arena_map_mask;
+       arena_map[j] != 0;
+       j = (j + 1) & arena_map_mask)
+  {
+    ucnum k = arena_hash(arena_key(arena_map[j]->block)) & arena_map_mask;
+
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+
+    arena_map[i] = arena_map[j];
+    arena_map[j] = 0;
+    i = j;
+  }
+}
+
+#if !HAVE_MMAP
+
+/*
+ * Without mmap, arenas are carved ARENA_GROUP at a time out of a malloced
+ * block which is one arena larger than the group, so that they can be
+ * aligned. An arena given back by arena_free goes on a free list to be
+ * reused; the block is freed once none of its arenas is in use.
+ */
+struct arena_group {
+  mem_t *raw;
+  int used;
+};
+
+struct free_arena {
+  struct free_arena *next;
+  struct arena_group *group;
+};
+
+static struct free_arena *free_arenas;
+
+static void arena_group_new(void)
+{
+  size_t size = HEAP_ARENA_SIZE;
+  struct arena_group *group = coerce(struct arena_group *,
+                                     chk_malloc_gc_more(sizeof *group));
+  mem_t *raw = chk_malloc_gc_more((ARENA_GROUP + 1) * size);
+  mem_t *aligned = coerce(mem_t *, (coerce(uint_ptr_t, raw) + size - 1) &
+                                   ~(convert(uint_ptr_t, size) - 1));
+  int i;
+
+  group->raw = raw;
+  group->used = 0;
+
+  for (i = ARENA_GROUP - 1; i >= 0; i--) {
+    struct free_arena *fa = coerce(struct free_arena *, aligned + i * size);
+    fa->next = free_arenas;
+    fa->group = group;
+    free_arenas = fa;
+  }
+}
+
+#endif
+
+static obj_t *arena_alloc(mem_t **palloc)
+{
+#if HAVE_MMAP
+  size_t size = HEAP_ARENA_SIZE;
+  mem_t *raw = coerce(mem_t *, mmap(0, 2 * size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  mem_t *aligned;
+  size_t head;
+
+  if (raw == coerce(mem_t *, MAP_FAILED))
+    uw_throwf(alloc_error_s, lit("out of memory"), nao);
+
+  aligned = coerce(mem_t *, (coerce(uint_ptr_t, raw) + size - 1) &
+                            ~(convert(uint_ptr_t, size) - 1));
+  head = aligned - raw;
+
+  if (head > 0)
+    munmap(raw, head);
+  munmap(aligned + size, size - head);
+
+  *palloc = aligned;
+  return coerce(obj_t *, aligned);
+#else
+  struct free_arena *fa;
+
+  if (free_arenas == 0)
+    arena_group_new();
+
+  fa = free_arenas;
+  free_arenas = fa->next;
+  fa->group->used++;
+  *palloc = coerce(mem_t *, fa->group);
+  return coerce(obj_t *, fa);
+#endif
+}
+
+static void arena_free(heap_t *heap)
+{
+#if HAVE_MMAP
+  munmap(heap->alloc, HEAP_ARENA_SIZE);
+#else
+  struct arena_group *group = coerce(struct arena_group *, heap->alloc);
+  uint_ptr_t base = coerce(uint_ptr_t, heap->block) & ~(HEAP_ARENA_SIZE - 1);
+  struct free_arena *fa = coerce(struct free_arena *, base);
+
+  if (--group->used > 0) {
+    fa->next = free_arenas;
+    fa->group = group;
+    free_arenas = fa;
+  } else {
+    struct free_arena **pfa = &free_arenas;
+
+    while ((fa = *pfa) != 0) {
+      if (fa->group == group)
+        *pfa = fa->next;
+      else
+        pfa = &fa->next;
+    }
+
+    free(group->raw);
+    free(group);
+  }
+#endif
+}
+
+static void more(struct pool *pool)
+{
+  mem_t *alloc;
+  union arena_hdr *hdr = coerce(union arena_hdr *, arena_alloc(&alloc));
+  obj_t *block = coerce(obj_t *, hdr + 1);
+  obj_t *end = coerce(obj_t *, coerce(mem_t *, block) + pool->size * pool->cell);
   heap_t *heap = coerce(heap_t *, chk_malloc_gc_more(sizeof *heap));
-  obj_t *block = heap->block, *end = heap->block + HEAP_SIZE;
 
-  if (free_list == 0)
-    free_tail = &heap->block[0].t.next;
+  hdr->heap = heap;
+  heap->pool = pool;
+  heap->block = block;
+  heap->end = end;
+  heap->alloc = alloc;
+  heap->marked = 0;
+  heap->retired = 0;
+  memset(heap->marks, 0, sizeof heap->marks);
+#if CONFIG_GEN_GC
+  heap->dirty_next = 0;
+  heap->dirty_listed = 0;
+  memset(heap->dirty, 0, sizeof heap->dirty);
+#endif
+
+  if (pool->free_list == 0)
+    pool->free_tail = &heap->block[0].t.next;
 
   if (end > heap_max_bound)
     heap_max_bound = end;
@@ -147,7 +564,7 @@ static void more(void)
     heap_min_bound = block;
 
   while (block < end) {
-    block->t.next = free_list;
+    block->t.next = pool->free_list;
     block->t.type = convert(type_t, FREE);
 #if CONFIG_EXTRA_DEBUGGING
       if (block == break_obj) {
@@ -157,19 +574,220 @@ static void more(void)
         breakpt();
       }
 #endif
-    free_list = block++;
+    pool->free_list = block;
+    block = heap_succ(block, pool->cell);
   }
 
   heap->next = heap_list;
   heap_list = heap;
+  pool->heaps++;
+  gc_stat.heaps_added++;
+
+  arena_map_insert(heap);
 
 #if HAVE_VALGRIND
   if (opt_vg_debug)
-    VALGRIND_MAKE_MEM_NOACCESS(&heap->block, sizeof heap->block);
+    VALGRIND_MAKE_MEM_NOACCESS(heap->block, heap_bytes(heap));
 #endif
 }
 
-val make_obj(void)
+static int prof_frame_ok(struct prof_frame *pf, mem_t *sp)
+{
+  mem_t *p = coerce(mem_t *, pf);
+  mem_t *bottom = coerce(mem_t *, gc_stack_bottom);
+
+  if (sp < bottom)
+    return p > sp && p < bottom;
+  return p < sp && p > bottom;
+}
+
+static int prof_same(struct prof_site *site, struct prof_frame *frame,
+                     int depth)
+{
+  int i;
+
+  if (site->depth != depth)
+    return 0;
+
+  for (i = 0; i < depth; i++)
+    if (site->frame[i].code != frame[i].code ||
+        site->frame[i].ip != frame[i].ip)
+      return 0;
+
+  return 1;
+}
+
+static int prof_tab_grow(void)
+{
+  ucnum old_size = prof_tab ? prof_tab_mask + 1 : 0;
+  ucnum new_size = old_size ? 2 * old_size : PROF_TAB_INIT_SIZE;
+  struct prof_site **old_tab = prof_tab;
+  struct prof_site **new_tab;
+  ucnum i, j;
+
+  new_tab = coerce(struct prof_site **, calloc(new_size, sizeof *new_tab));
+
+  if (new_tab == 0)
+    return 0;
+
+  prof_tab = new_tab;
+  prof_tab_mask = new_size - 1;
+
+  for (j = 0; j < old_size; j++) {
+    struct prof_site *site = old_tab[j];
+    if (site) {
+      for (i = site->hash & prof_tab_mask;
+           prof_tab[i] != 0;
+           i = (i + 1) & prof_tab_mask)
+        ; /* empty */
+      prof_tab[i] = site;
+    }
+  }
+
+  free(old_tab);
+  return 1;
+}
+
+static struct prof_site *prof_sample(void)
+{
+  struct prof_frame frame[PROF_DEPTH];
+  struct prof_frame *pf;
+  mem_t *sp = coerce(mem_t *, frame);
+  struct prof_site *site;
+  ucnum hash = 0, i;
+  int depth = 0;
+
+  if (prof_busy)
+    return 0;
+
+  for (pf = prof_top;
+       pf != 0 && depth < PROF_DEPTH && prof_frame_ok(pf, sp);
+       pf = pf->up)
+  {
+    frame[depth] = *pf;
+    frame[depth].up = 0;
+    hash = hash * 31 + (coerce(ucnum, pf->code) >> 4) + pf->ip;
+    depth++;
+  }
+
+  if (2 * (prof_tab_count + 1) > prof_tab_mask + 1 || !prof_tab)
+    if (!prof_tab_grow())
+      return 0;
+
+  for (i = hash & prof_tab_mask;
+       (site = prof_tab[i]) != 0;
+       i = (i + 1) & prof_tab_mask)
+  {
+    if (site->hash == hash && prof_same(site, frame, depth)) {
+      site->samples++;
+      return site;
+    }
+  }
+
+  if ((site = coerce(struct prof_site *, calloc(1, sizeof *site))) == 0)
+    return 0;
+
+  site->hash = hash;
+  site->depth = depth;
+  memcpy(site->frame, frame, depth * sizeof *frame);
+  site->samples = 1;
+  prof_tab[i] = site;
+  prof_tab_count++;
+  return site;
+}
+
+static ucnum prof_due(size_t size)
+{
+  ucnum n;
+
+  if ((prof_left -= size) > 0)
+    return 0;
+
+  n = 1 + convert(ucnum, -prof_left) / alloc_prof_period;
+  prof_left += n * alloc_prof_period;
+  return n * alloc_prof_period;
+}
+
+static void prof_resolve(void)
+{
+  if (prof_pend.obj) {
+    unsigned t = prof_pend.obj->t.type & ~(REACHABLE | FREE | MARK_PENDING);
+    if (t <= MAXTYPE)
+      prof_pend.site->bytes[t] += prof_pend.bytes;
+    prof_pend.site = 0;
+    prof_pend.obj = 0;
+  }
+}
+
+static void prof_obj(size_t size)
+{
+  ucnum bytes;
+
+  prof_resolve();
+
+  if ((bytes = prof_due(size)) != 0) {
+    prof_pend.site = prof_sample();
+    prof_pend.bytes = bytes;
+    prof_pend.obj = 0;
+  }
+}
+
+void gc_prof_malloc(size_t size)
+{
+  ucnum bytes = prof_due(size);
+  struct prof_site *site;
+
+  if (bytes != 0 && (site = prof_sample()) != 0)
+    site->bytes[PROF_MALLOC] += bytes;
+}
+
+static void prof_free(void)
+{
+  ucnum i;
+
+  if (!prof_tab)
+    return;
+
+  for (i = 0; i <= prof_tab_mask; i++)
+    free(prof_tab[i]);
+
+  free(prof_tab);
+  prof_tab = 0;
+  prof_tab_mask = prof_tab_count = 0;
+  prof_pend.site = 0;
+  prof_pend.obj = 0;
+}
+
+#if CONFIG_GEN_GC
+static void freshobj_add(val obj)
+{
+  if (freshobj_idx < FRESHOBJ_VEC_SIZE) {
+    freshobj[freshobj_idx++] = obj;
+    return;
+  }
+
+  bug_unless (mark_incr);
+
+  if (freshobj_ovf_count >= freshobj_ovf_size) {
+    freshobj_ovf_size = if3(freshobj_ovf_size, 2 * freshobj_ovf_size,
+                            FRESHOBJ_VEC_SIZE);
+    freshobj_ovf = coerce(val *, chk_realloc(coerce(mem_t *, freshobj_ovf),
+                                             freshobj_ovf_size *
+                                             sizeof *freshobj_ovf));
+  }
+
+  freshobj_ovf[freshobj_ovf_count++] = obj;
+}
+
+static void freshobj_ovf_free(void)
+{
+  free(freshobj_ovf);
+  freshobj_ovf = 0;
+  freshobj_ovf_count = freshobj_ovf_size = 0;
+}
+#endif
+
+static val make_pool_obj(struct pool *pool)
 {
   int tries;
   alloc_bytes_t malloc_delta = malloc_bytes - prev_malloc_bytes;
@@ -181,37 +799,49 @@ val make_obj(void)
       gc_enabled)
   {
     gc();
+  } else if (mark_incr && --mark_incr_countdown <= 0 && gc_enabled) {
+    mark_incr_step();
   }
 
-  if (freshobj_idx >= FRESHOBJ_VEC_SIZE)
+  if (freshobj_idx >= FRESHOBJ_VEC_SIZE && !full_gc) {
+    gc_cnt.full_fresh++;
     full_gc = 1;
+  }
 #else
   if ((opt_gc_debug || malloc_delta >= opt_gc_delta) && gc_enabled) {
     gc();
   }
 #endif
 
+  if (alloc_prof_period)
+    prof_obj(pool->cell);
+
   for (tries = 0; tries < 3; tries++) {
-    if (free_list) {
-      val ret = free_list;
+    while (pool->free_list == 0 && sweep_next != 0 && !inprogress)
+      sweep_lazy_step();
+
+    if (pool->free_list) {
+      val ret = pool->free_list;
 #if HAVE_VALGRIND
       if (opt_vg_debug)
-        VALGRIND_MAKE_MEM_DEFINED(free_list, sizeof *free_list);
+        VALGRIND_MAKE_MEM_DEFINED(ret, pool->cell);
 #endif
-      free_list = free_list->t.next;
+      pool->free_list = ret->t.next;
 
-      if (free_list == 0)
-        free_tail = &free_list;
+      if (pool->free_list == 0)
+        pool->free_tail = &pool->free_list;
 #if HAVE_VALGRIND
       if (opt_vg_debug)
-        VALGRIND_MAKE_MEM_UNDEFINED(ret, sizeof *ret);
+        VALGRIND_MAKE_MEM_UNDEFINED(ret, pool->cell);
 #endif
 #if CONFIG_GEN_GC
       ret->t.gen = 0;
-      if (!full_gc)
-        freshobj[freshobj_idx++] = ret;
+      if (!full_gc || mark_incr)
+        freshobj_add(ret);
 #endif
-      gc_bytes += sizeof (obj_t);
+      gc_bytes += pool->cell;
+      if (prof_pend.site != 0 && prof_pend.obj == 0)
+        prof_pend.obj = ret;
 #if CONFIG_EXTRA_DEBUGGING
       if (ret == break_obj) {
 #if HAVE_VALGRIND
@@ -224,8 +854,8 @@ val make_obj(void)
     }
 
 #if CONFIG_GEN_GC
-    if (!full_gc && freshobj_idx < FRESHOBJ_VEC_SIZE) {
-      more();
+    if ((!full_gc || mark_incr) && freshobj_idx < FRESHOBJ_VEC_SIZE) {
+      more(pool);
       continue;
     }
 #endif
@@ -238,7 +868,7 @@ val make_obj(void)
       }
       /* fallthrough */
     case 1:
-      more();
+      more(pool);
       break;
     }
   }
@@ -246,6 +876,16 @@ val make_obj(void)
   abort();
 }
 
+val make_obj(void)
+{
+  return make_pool_obj(&pools[OBJ_POOL]);
+}
+
+val make_cons_obj(void)
+{
+  return make_pool_obj(&pools[CONS_POOL]);
+}
+
 static void finalize(val obj)
 {
   switch (convert(type_t, obj->t.type)) {
@@ -266,6 +906,7 @@ static void finalize(val obj)
     obj->s.slot_cache = 0;
     return;
   case STR:
+    str_hash_invalidate(obj);
     free(obj->st.str);
     obj->st.str = 0;
     return;
@@ -305,39 +946,92 @@ void cobj_destroy_free_op(val obj)
   free(obj->co.handle);
 }
 
-static void mark_obj(val obj)
+/*
+ * Under mark_bitmap, mark bits are kept in a bitmap in each heap's
+ * descriptor, which is allocated apart from the heap's arena, rather than in
+ * the objects' type fields. Together with not rewriting the generation field
+ * of objects which are already mature, this means that a collection does not
+ * store into reachable mature objects, so that processes forked from a
+ * common parent continue to share the pages holding their old objects.
+ */
+INLINE int marked_p(val obj)
 {
-  type_t t;
+  if (mark_bitmap) {
+    heap_t *heap = heap_of(obj);
+    cnum i = granule_of(obj);
+    return (heap->marks[i / PTR_BIT] >> (i % PTR_BIT)) & 1;
+  }
 
-#if 1
-tail_call:
-#define mark_obj_tail(o) do { obj = (o); goto tail_call; } while (0)
-#else
-#define mark_obj_tail(o) return mark_obj(o)
-#endif
+  return (obj->t.type & REACHABLE) != 0;
+}
+
+INLINE void mark_flag(val obj)
+{
+  if (mark_bitmap) {
+    heap_t *heap = heap_of(obj);
+    cnum i = granule_of(obj);
+    heap->marks[i / PTR_BIT] |= convert(ucnum, 1) << (i % PTR_BIT);
+  } else {
+    obj->t.type = convert(type_t, obj->t.type | REACHABLE);
+  }
+}
+
+INLINE void mark_unflag(val obj)
+{
+  if (mark_bitmap) {
+    heap_t *heap = heap_of(obj);
+    cnum i = granule_of(obj);
+    heap->marks[i / PTR_BIT] &= ~(convert(ucnum, 1) << (i % PTR_BIT));
+  } else {
+    obj->t.type = convert(type_t, obj->t.type & ~REACHABLE);
+  }
+}
+
+/*
+ * Marking uses an explicit stack rather than C recursion, so that deeply
+ * nested structure cannot exhaust the C stack. An object is flagged
+ * REACHABLE when it is pushed, and its children are examined when it is
+ * popped. If the stack cannot be grown, the object is flagged MARK_PENDING
+ * instead of being pushed, and such objects are later found by a scan of
+ * the heaps.
+ */
+static int mark_set(val obj)
+{
+  type_t t;
+  heap_t *heap;
 
   if (!is_ptr(obj))
-    return;
+    return 0;
 
   t = obj->t.type;
 
-  if ((t & REACHABLE) != 0)
-    return;
-
 #if CONFIG_GEN_GC
   if (!full_gc && obj->t.gen > 0)
-    return;
+    return 0;
 #endif
 
+  if (marked_p(obj))
+    return 0;
+
   if ((t & FREE) != 0)
     abort();
 
 #if CONFIG_GEN_GC
-  if (obj->t.gen == -1)
+  /* In a full collection, everything reachable is promoted to generation 1
+     right away, since a lazy sweep may not get to the object before the
+     mutator stores into it. */
+  if (full_gc) {
+    if (obj->t.gen != 1)
+      obj->t.gen = 1;
+  } else if (obj->t.gen == -1) {
     obj->t.gen = 0;  /* Will be promoted to generation 1 by sweep_one */
+  }
 #endif
 
-  obj->t.type = convert(type_t, t | REACHABLE);
+  mark_flag(obj);
+  heap = heap_of(obj);
+  heap->marked++;
+  heap->pool->marked++;
 
 #if CONFIG_EXTRA_DEBUGGING
   if (obj == break_obj) {
@@ -348,6 +1042,47 @@ tail_call:
   }
 #endif
 
+  return 1;
+}
+
+static void mark_stack_push(val obj)
+{
+  if (mark_stack_top == mark_stack_size) {
+    cnum new_size = if3(mark_stack_size, 2 * mark_stack_size,
+                        MARK_STACK_INIT_SIZE);
+    val *new_stack = coerce(val *, realloc(mark_stack,
+                                           new_size * sizeof *mark_stack));
+    if (new_stack == 0) {
+      obj->t.type = convert(type_t, obj->t.type | MARK_PENDING);
+      mark_pending++;
+      return;
+    }
+
+    mark_stack = new_stack;
+    mark_stack_size = new_size;
+  }
+
+  mark_stack[mark_stack_top++] = obj;
+}
+
+static void mark_push(val obj)
+{
+  if (mark_set(obj))
+    mark_stack_push(obj);
+}
+
+static void mark_scan(val obj)
+{
+  type_t t;
+
+tail_call:
+#define mark_obj_tail(o) do { obj = (o);                  \
+                              if (!mark_set(obj))         \
+                                return;                   \
+                              goto tail_call; } while (0)
+
+  t = convert(type_t, obj->t.type & ~REACHABLE);
+
   switch (t) {
   case NIL:
   case CHR:
@@ -357,25 +1092,25 @@ tail_call:
   case FLNUM:
     return;
   case CONS:
-    mark_obj(obj->c.car);
-    mark_obj_tail(obj->c.cdr);
+    mark_push(obj->c.cdr);
+    mark_obj_tail(obj->c.car);
   case STR:
-    mark_obj(obj->st.len);
+    mark_push(obj->st.len);
     mark_obj_tail(obj->st.alloc);
   case SYM:
-    mark_obj(obj->s.name);
+    mark_push(obj->s.name);
     mark_obj_tail(obj->s.package);
   case PKG:
-    mark_obj(obj->pk.name);
-    mark_obj(obj->pk.hidhash);
+    mark_push(obj->pk.name);
+    mark_push(obj->pk.hidhash);
     mark_obj_tail(obj->pk.symhash);
   case FUN:
     switch (obj->f.functype) {
     case FINTERP:
-      mark_obj(obj->f.f.interp_fun);
+      mark_push(obj->f.f.interp_fun);
       break;
     case FVM:
-      mark_obj(obj->f.f.vm_desc);
+      mark_push(obj->f.f.vm_desc);
       break;
     }
     mark_obj_tail(obj->f.env);
@@ -385,41 +1120,85 @@ tail_call:
       val len = obj->v.vec[vec_length];
       cnum i, fp = c_num(len);
 
-      mark_obj(alloc_size);
-      mark_obj(len);
+      mark_push(alloc_size);
+      mark_push(len);
 
-      for (i = 0; i < fp; i++)
-        mark_obj(obj->v.vec[i]);
+      for (i = fp - 1; i >= 0; i--)
+        mark_push(obj->v.vec[i]);
     }
     return;
   case LCONS:
-    mark_obj(obj->lc.func);
-    mark_obj(obj->lc.car);
-    mark_obj_tail(obj->lc.cdr);
+    mark_push(obj->lc.func);
+    mark_push(obj->lc.cdr);
+    mark_obj_tail(obj->lc.car);
   case LSTR:
-    mark_obj(obj->ls.prefix);
-    mark_obj(obj->ls.props->limit);
-    mark_obj(obj->ls.props->term);
+    mark_push(obj->ls.prefix);
+    mark_push(obj->ls.props->limit);
+    mark_push(obj->ls.props->term);
     mark_obj_tail(obj->ls.list);
   case COBJ:
   case CPTR:
     obj->co.ops->mark(obj);
     mark_obj_tail(obj->co.cls);
   case ENV:
-    mark_obj(obj->e.vbindings);
-    mark_obj(obj->e.fbindings);
+    mark_push(obj->e.vbindings);
+    mark_push(obj->e.fbindings);
     mark_obj_tail(obj->e.up_env);
   case RNG:
-    mark_obj(obj->rn.from);
+    mark_push(obj->rn.from);
     mark_obj_tail(obj->rn.to);
   case BUF:
-    mark_obj(obj->b.len);
+    mark_push(obj->b.len);
     mark_obj_tail(obj->b.size);
   }
 
+#undef mark_obj_tail
+
   assert (0 && "corrupt type field");
 }
 
+static void mark_rescan_pending(void)
+{
+  heap_t *heap;
+
+  for (heap = heap_list; heap != 0 && mark_pending > 0; heap = heap->next) {
+    obj_t *block, *end;
+    size_t cell = heap->pool->cell;
+
+    for (block = heap->block, end = heap->end;
+         block < end && mark_pending > 0;
+         block = heap_succ(block, cell))
+    {
+      if ((block->t.type & MARK_PENDING) != 0) {
+        block->t.type = convert(type_t, block->t.type & ~MARK_PENDING);
+        mark_pending--;
+        mark_scan(block);
+        while (mark_stack_top > 0)
+          mark_scan(mark_stack[--mark_stack_top]);
+      }
+    }
+  }
+}
+
+static void mark_obj(val obj)
+{
+  mark_push(obj);
+
+  if (mark_draining)
+    return;
+
+  mark_draining = 1;
+
+  do {
+    while (mark_stack_top > 0)
+      mark_scan(mark_stack[--mark_stack_top]);
+    if (mark_pending > 0)
+      mark_rescan_pending();
+  } while (mark_stack_top > 0 || mark_pending > 0);
+
+  mark_draining = 0;
+}
+
 void cobj_mark_op(val obj)
 {
 }
@@ -434,13 +1213,10 @@ static int in_heap(val ptr)
   if (ptr < heap_min_bound || ptr >= heap_max_bound)
     return 0;
 
-  for (heap = heap_list; heap != 0; heap = heap->next) {
-    if (ptr >= heap->block && ptr < heap->block + HEAP_SIZE)
-      if ((coerce(char *, ptr) - coerce(char *, heap->block)) % sizeof (obj_t) == 0)
-        return 1;
-  }
+  if ((heap = arena_lookup(ptr)) == 0 || ptr < heap->block || ptr >= heap->end)
+    return 0;
 
-  return 0;
+  return (coerce(char *, ptr) - coerce(char *, heap->block)) % heap->pool->cell == 0;
 }
 
 static void mark_obj_maybe(val maybe_obj)
@@ -477,6 +1253,91 @@ static void mark_mem_region(val *low, val *high)
     mark_obj_maybe(*low);
 }
 
+#if CONFIG_GEN_GC
+
+static void dirty_obj(val obj)
+{
+  heap_t *heap = heap_of(obj);
+  cnum i = granule_of(obj);
+
+  obj->t.gen = -1;
+  heap->dirty[i / PTR_BIT] |= convert(ucnum, 1) << (i % PTR_BIT);
+
+  if (!heap->dirty_listed) {
+    heap->dirty_listed = 1;
+    heap->dirty_next = dirty_heaps;
+    dirty_heaps = heap;
+  }
+}
+
+static void dirty_each(void (*fun)(val))
+{
+  heap_t *heap;
+
+  for (heap = dirty_heaps; heap != 0; heap = heap->dirty_next) {
+    mem_t *arena = coerce(mem_t *, heap->block) - sizeof (union arena_hdr);
+    size_t cell = heap->pool->cell;
+    int w;
+
+    for (w = 0; w < BITMAP_WORDS; w++) {
+      ucnum bits = heap->dirty[w];
+      int b;
+
+      for (b = 0; bits != 0; b++, bits >>= 1) {
+        if ((bits & 1) != 0) {
+          /* The object is the one cell which begins in the granule. */
+          size_t off = (w * PTR_BIT + b) * MARK_GRANULE -
+                       sizeof (union arena_hdr);
+          fun(coerce(val, arena + sizeof (union arena_hdr) +
+                          (off + cell - 1) / cell * cell));
+        }
+      }
+    }
+  }
+}
+
+static void dirty_clear(void)
+{
+  heap_t *heap, *next;
+
+  for (heap = dirty_heaps; heap != 0; heap = next) {
+    next = heap->dirty_next;
+    memset(heap->dirty, 0, sizeof heap->dirty);
+    heap->dirty_listed = 0;
+    heap->dirty_next = 0;
+  }
+
+  dirty_heaps = 0;
+}
+
+static void mark_dirty_obj(val obj)
+{
+  /* A lazy sweep may have returned the object to generation 1
+     after it was recorded; it must be traversed regardless. */
+  obj->t.gen = 0;
+  gc_cnt.dirty_scanned++;
+  mark_obj(obj);
+}
+
+#endif
+
+static void prof_mark(void)
+{
+  ucnum i;
+  int j;
+
+  if (!prof_tab)
+    return;
+
+  for (i = 0; i <= prof_tab_mask; i++) {
+    struct prof_site *site = prof_tab[i];
+    if (site) {
+      for (j = 0; j < site->depth; j++)
+        mark_obj(site->frame[j].code);
+    }
+  }
+}
+
 static void mark(mach_context_t *pmc, val *gc_stack_top)
 {
   val **rootloc;
@@ -487,18 +1348,17 @@ static void mark(mach_context_t *pmc, val *gc_stack_top)
   for (rootloc = prot_stack; rootloc != gc_prot_top; rootloc++)
     mark_obj(**rootloc);
 
+  /*
+   * The frames recorded by the allocation profiler.
+   */
+  prof_mark();
+
 #if CONFIG_GEN_GC
   /*
    * Mark the additional objects indicated for marking.
    */
   if (!full_gc)
-  {
-    int i;
-    for (i = 0; i < checkobj_idx; i++)
-      mark_obj(checkobj[i]);
-    for (i = 0; i < mutobj_idx; i++)
-      mark_obj(mutobj[i]);
-  }
+    dirty_each(mark_dirty_obj);
 #endif
 
   /*
@@ -512,7 +1372,110 @@ static void mark(mach_context_t *pmc, val *gc_stack_top)
   mark_mem_region(gc_stack_top - STACK_TOP_EXTRA_WORDS, gc_stack_bottom);
 }
 
-static int sweep_one(obj_t *block)
+static ucnum gc_usec(void)
+{
+  struct timeval tv;
+  if (gettimeofday(&tv, 0) == -1)
+    return 0;
+  return convert(ucnum, tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static void pause_record(ucnum usec)
+{
+  int b = 0;
+
+  while (b < PAUSE_BUCKETS - 1 && usec >= convert(ucnum, 1) << b)
+    b++;
+
+  gc_pauses.count++;
+  gc_pauses.total += usec;
+  if (usec > gc_pauses.max)
+    gc_pauses.max = usec;
+  gc_pauses.hist[b]++;
+}
+
+#if CONFIG_GEN_GC
+
+static void mark_incr_start(void)
+{
+  val **rootloc;
+
+  for (rootloc = prot_stack; rootloc != gc_prot_top; rootloc++)
+    mark_push(**rootloc);
+
+  mark_incr = 1;
+  mark_incr_countdown = MARK_INCR_ALLOC_STEP;
+}
+
+static void mark_incr_step(void)
+{
+  ucnum start = gc_usec();
+  ucnum deadline = start + opt_gc_pause_budget;
+  int done = 0;
+
+  gc_enabled = 0;
+  inprogress++;
+  mark_draining = 1;
+
+  for (;;) {
+    int n;
+
+    for (n = 0; n < MARK_INCR_CHECK && mark_stack_top > 0; n++)
+      mark_scan(mark_stack[--mark_stack_top]);
+
+    if (mark_stack_top == 0) {
+      if (mark_pending == 0) {
+        done = 1;
+        break;
+      }
+      mark_rescan_pending();
+    }
+
+    if (gc_usec() >= deadline)
+      break;
+  }
+
+  mark_draining = 0;
+  inprogress--;
+  gc_enabled = 1;
+
+  gc_cnt.incr_steps++;
+  mark_incr_countdown = MARK_INCR_ALLOC_STEP;
+  pause_record(gc_usec() - start);
+
+  if (done)
+    gc();
+}
+
+static void mark_incr_finish(void)
+{
+  int i;
+
+  mark_incr = 0;
+
+  /* Entries of weak tables are not marked, so the barrier did not
+     see values or keys stored into them during the cycle. */
+  hash_remark_weak();
+
+  /* Objects allocated during the cycle were stored into without
+     a barrier; they are all treated as reachable. */
+  for (i = 0; i < freshobj_idx; i++)
+    mark_obj(freshobj[i]);
+
+  for (i = 0; convert(ucnum, i) < freshobj_ovf_count; i++)
+    mark_obj(freshobj_ovf[i]);
+
+  freshobj_ovf_free();
+}
+
+static void mark_regray(val obj)
+{
+  mark_stack_push(obj);
+}
+
+#endif
+
+static void sweep_link(struct pool *pool, obj_t *block)
 {
 #if HAVE_VALGRIND
   const int vg_dbg = opt_vg_debug;
@@ -520,6 +1483,40 @@ static int sweep_one(obj_t *block)
   const int vg_dbg = 0;
 #endif
 
+  /* If debugging is turned on, we want to catch instances
+     where a reachable object is wrongly freed. This is difficult
+     to do if the object is recycled soon after.
+     So when debugging is on, the free list is FIFO
+     rather than LIFO, which increases our chances that the
+     code which is still using the object will trip on
+     the freed object before it is recycled. */
+  if (vg_dbg || opt_gc_debug) {
+#if HAVE_VALGRIND
+    if (vg_dbg && pool->free_tail != &pool->free_list)
+      VALGRIND_MAKE_MEM_DEFINED(pool->free_tail, sizeof *pool->free_tail);
+#endif
+    *pool->free_tail = block;
+    block->t.next = nil;
+#if HAVE_VALGRIND
+    if (vg_dbg) {
+      if (pool->free_tail != &pool->free_list)
+        VALGRIND_MAKE_MEM_NOACCESS(pool->free_tail, sizeof *pool->free_tail);
+      VALGRIND_MAKE_MEM_NOACCESS(block, pool->cell);
+    }
+#endif
+    pool->free_tail = &block->t.next;
+  } else {
+    block->t.next = pool->free_list;
+    pool->free_list = block;
+  }
+}
+
+static int sweep_one(struct pool *pool, obj_t *block)
+{
+#if HAVE_VALGRIND
+  const int vg_dbg = opt_vg_debug;
+#endif
+
 #if CONFIG_EXTRA_DEBUGGING
   if (block == break_obj) {
 #if HAVE_VALGRIND
@@ -531,122 +1528,296 @@ static int sweep_one(obj_t *block)
   }
 #endif
 
-#if CONFIG_GEN_GC
-  if (!full_gc && block->t.gen > 0)
-    abort();
+  if ((block->t.type & (REACHABLE | FREE)) == (REACHABLE | FREE))
+    abort();
+
+  if (marked_p(block)) {
+#if CONFIG_GEN_GC
+    if (block->t.gen != 1)
+      block->t.gen = 1;
+#endif
+    mark_unflag(block);
+    gc_stat.retained[block->t.type & ~(REACHABLE | MARK_PENDING)]++;
+    return 0;
+  }
+
+  if (block->t.type & FREE) {
+#if HAVE_VALGRIND
+    if (vg_dbg)
+      VALGRIND_MAKE_MEM_NOACCESS(block, pool->cell);
+#endif
+    return 1;
+  }
+
+  gc_stat.freed[block->t.type]++;
+  finalize(block);
+  block->t.type = convert(type_t, block->t.type | FREE);
+  sweep_link(pool, block);
+  return 1;
+}
+
+#if CONFIG_GEN_GC
+
+static void sweep_dirty_obj(val obj)
+{
+  (void) sweep_one(heap_of(obj)->pool, obj);
+}
+
 #endif
 
-  if ((block->t.type & (REACHABLE | FREE)) == (REACHABLE | FREE))
-    abort();
+/*
+ * Decide how many of the heaps in which nothing was marked by a full
+ * collection are to be released. Each pool keeps opt_gc_heap_slack percent
+ * of the number of its heaps that are still in use, but at least one; if
+ * opt_gc_heap_slack is negative, nothing is released.
+ */
+static void sweep_plan_release(void)
+{
+  heap_t *heap;
+  int i;
+
+  for (i = 0; i < NUM_POOLS; i++)
+    pools[i].release = 0;
 
-  if (block->t.type & REACHABLE) {
 #if CONFIG_GEN_GC
-    block->t.gen = 1;
+  if (!full_gc)
+    return;
 #endif
-    block->t.type = convert(type_t, block->t.type & ~REACHABLE);
-    return 0;
+
+  if (opt_gc_heap_slack < 0)
+    return;
+
+  for (heap = heap_list; heap != 0; heap = heap->next)
+    if (heap->marked == 0)
+      heap->pool->release++;
+
+  for (i = 0; i < NUM_POOLS; i++) {
+    struct pool *pool = &pools[i];
+    cnum keep = (pool->heaps - pool->release) * opt_gc_heap_slack / 100;
+
+    if (keep < 1)
+      keep = 1;
+
+    pool->release = pool->release > keep ? pool->release - keep : 0;
   }
+}
+
+static int sweep_retire(heap_t *heap)
+{
+  struct pool *pool = heap->pool;
+  size_t cell = pool->cell;
+  obj_t *block, *end;
+
+  if (heap->marked != 0 || pool->release == 0)
+    return 0;
 
-  if (block->t.type & FREE) {
 #if HAVE_VALGRIND
-    if (vg_dbg)
-      VALGRIND_MAKE_MEM_NOACCESS(block, sizeof *block);
+  if (opt_vg_debug)
+    VALGRIND_MAKE_MEM_DEFINED(heap->block, heap_bytes(heap));
 #endif
-    return 1;
+
+  for (block = heap->block, end = heap->end;
+       block < end;
+       block = heap_succ(block, cell))
+  {
+    if ((block->t.type & FREE) != 0)
+      continue;
+    gc_stat.freed[block->t.type]++;
+    finalize(block);
+    block->t.type = convert(type_t, block->t.type | FREE);
   }
 
-  finalize(block);
-  block->t.type = convert(type_t, block->t.type | FREE);
+  heap->retired = 1;
+  pool->release--;
+  heaps_retired++;
+  return 1;
+}
 
-  /* If debugging is turned on, we want to catch instances
-     where a reachable object is wrongly freed. This is difficult
-     to do if the object is recycled soon after.
-     So when debugging is on, the free list is FIFO
-     rather than LIFO, which increases our chances that the
-     code which is still using the object will trip on
-     the freed object before it is recycled. */
-  if (vg_dbg || opt_gc_debug) {
-#if HAVE_VALGRIND
-    if (vg_dbg && free_tail != &free_list)
-      VALGRIND_MAKE_MEM_DEFINED(free_tail, sizeof *free_tail);
-#endif
-    *free_tail = block;
-    block->t.next = nil;
-#if HAVE_VALGRIND
-    if (vg_dbg) {
-      if (free_tail != &free_list)
-        VALGRIND_MAKE_MEM_NOACCESS(free_tail, sizeof *free_tail);
-      VALGRIND_MAKE_MEM_NOACCESS(block, sizeof *block);
+/*
+ * Retired heaps are released only after every heap has been swept, since
+ * finalizing a garbage object in one heap may access another garbage object
+ * in a heap which has already been retired.
+ */
+static void heap_release_retired(void)
+{
+  heap_t **pheap = &heap_list, *heap;
+
+  if (heaps_retired == 0)
+    return;
+
+  while ((heap = *pheap) != 0) {
+    if (heap->retired) {
+      *pheap = heap->next;
+      arena_map_remove(heap);
+      heap->pool->heaps--;
+      gc_stat.heaps_released++;
+      arena_free(heap);
+      free(heap);
+    } else {
+      pheap = &heap->next;
     }
-#endif
-    free_tail = &block->t.next;
-  } else {
-    block->t.next = free_list;
-    free_list = block;
   }
 
-  return 1;
+  heaps_retired = 0;
 }
 
-static int_ptr_t sweep(void)
+static int_ptr_t sweep_heap(heap_t *heap)
 {
+  struct pool *pool = heap->pool;
+  size_t cell = pool->cell;
   int_ptr_t free_count = 0;
-  heap_t *heap;
+  obj_t *block, *end;
+
 #if HAVE_VALGRIND
-  const int vg_dbg = opt_vg_debug;
+  if (opt_vg_debug)
+    VALGRIND_MAKE_MEM_DEFINED(heap->block, heap_bytes(heap));
 #endif
 
+  for (block = heap->block, end = heap->end;
+       block < end;
+       block = heap_succ(block, cell))
+  {
+    if ((block->t.type & FREE) != 0 && !marked_p(block)) {
+      sweep_link(pool, block);
+      free_count++;
+    } else {
+      free_count += sweep_one(pool, block);
+    }
+  }
+
+  return free_count;
+}
+
+static void sweep(void)
+{
+  heap_t *heap, *next;
+  int i;
+
 #if CONFIG_GEN_GC
   if (!full_gc) {
-    int i;
-
     /* No need to mark block defined via Valgrind API; everything
        in the freshobj is an allocated node! */
-    for (i = 0; i < freshobj_idx; i++)
-      free_count += sweep_one(freshobj[i]);
+    for (i = 0; i < freshobj_idx; i++) {
+      struct pool *pool = heap_of(freshobj[i])->pool;
+      if (freshobj[i]->t.gen > 0)
+        abort();
+      pool->freed += sweep_one(pool, freshobj[i]);
+    }
 
     /* Generation 1 objects that were indicated for dangerous
        mutation must have their REACHABLE flag flipped off,
        and must be returned to gen 1. */
-    for (i = 0; i < mutobj_idx; i++)
-      sweep_one(mutobj[i]);
+    dirty_each(sweep_dirty_obj);
 
-    return free_count;
+    return;
   }
 
 #endif
 
-  for (heap = heap_list; heap != 0; heap = heap->next) {
-    obj_t *block, *end;
+  /* The free lists are rebuilt, so that the free objects of
+     retired heaps are left out. */
+  sweep_plan_release();
 
-#if HAVE_VALGRIND
-    if (vg_dbg)
-        VALGRIND_MAKE_MEM_DEFINED(&heap->block, sizeof heap->block);
-#endif
+  for (i = 0; i < NUM_POOLS; i++) {
+    pools[i].free_list = 0;
+    pools[i].free_tail = &pools[i].free_list;
+  }
 
-    for (block = heap->block, end = heap->block + HEAP_SIZE;
-         block < end;
-         block++)
-    {
-      free_count += sweep_one(block);
-    }
+  for (heap = heap_list; heap != 0; heap = next) {
+    next = heap->next;
+    if (!sweep_retire(heap))
+      heap->pool->freed += sweep_heap(heap);
   }
+}
 
-  return free_count;
+/*
+ * Lazy sweeping: rather than sweeping every heap before gc returns, the
+ * free list is emptied and the heaps are queued for sweeping. make_obj
+ * sweeps the next queued heap whenever it runs out of free objects,
+ * relinking the heap's old free objects together with the newly freed ones.
+ * Heaps added by more() are placed in front of the queue, and so are never
+ * visited. The next gc finishes any remaining sweeping before marking.
+ */
+static void sweep_lazy_start(void)
+{
+  int i;
+
+  sweep_plan_release();
+
+  for (i = 0; i < NUM_POOLS; i++) {
+    struct pool *pool = &pools[i];
+    pool->free_list = 0;
+    pool->free_tail = &pool->free_list;
+    pool->freed = convert(int_ptr_t, pool->heaps - pool->release) *
+                  pool->size - pool->marked;
+  }
+
+  sweep_next = heap_list;
 }
 
-static int is_reachable(val obj)
+static void sweep_lazy_step(void)
 {
-  type_t t;
+  heap_t *heap = sweep_next;
+  int gc_save = gc_enabled;
+
+  sweep_next = heap->next;
+  gc_enabled = 0;
+  inprogress++;
+  if (!sweep_retire(heap))
+    sweep_heap(heap);
+  if (!sweep_next)
+    heap_release_retired();
+  inprogress--;
+  gc_enabled = gc_save;
+}
+
+static void sweep_finish(void)
+{
+  while (sweep_next)
+    sweep_lazy_step();
+}
 
+/*
+ * Lazy sweeping and incremental marking return to the mutator while marks
+ * are present, so they cannot leave REACHABLE flags in the type fields of
+ * live objects; they require the bitmap representation.
+ */
+void gc_set_mark_bitmap(int on)
+{
+  /* Heaps awaiting a lazy sweep carry marks in the old representation. */
+  if (!inprogress)
+    sweep_finish();
+  mark_bitmap = on || opt_gc_lazy_sweep || opt_gc_pause_budget != 0;
+}
+
+static int is_reachable(val obj)
+{
 #if CONFIG_GEN_GC
   if (!full_gc && obj->t.gen > 0)
     return 1;
 #endif
 
-  t = obj->t.type;
+  return marked_p(obj);
+}
+
+static void prof_weak(void)
+{
+  ucnum i;
+  int j;
+
+  if (!prof_tab)
+    return;
 
-  return (t & REACHABLE) != 0;
+  for (i = 0; i <= prof_tab_mask; i++) {
+    struct prof_site *site = prof_tab[i];
+    if (site) {
+      for (j = 0; j < site->depth; j++) {
+        val fun = site->frame[j].fun;
+        if (fun && !is_reachable(fun))
+          site->frame[j].fun = lambda_s;
+      }
+    }
+  }
 }
 
 static void prepare_finals(void)
@@ -702,14 +1873,17 @@ static val call_finalizers_impl(val ctx,
     struct fin_reg *next = found->next;
     val obj = found->obj;
     funcall1(found->fun, obj);
+    gc_stat.finals++;
 #if CONFIG_GEN_GC
     /* Note: here an object may be added to freshobj more than once, since
      * multiple finalizers can be registered.
      */
-    if (freshobj_idx < FRESHOBJ_VEC_SIZE && obj->t.gen == 0)
+    if (freshobj_idx < FRESHOBJ_VEC_SIZE && obj->t.gen == 0) {
       freshobj[freshobj_idx++] = obj;
-    else
+    } else if (!full_gc) {
+      gc_cnt.full_final++;
       full_gc = 1;
+    }
 #endif
     free(found);
     found = next;
@@ -730,64 +1904,163 @@ static void call_finals(void)
   (void) call_finalizers_impl(nil, is_unreachable_final);
 }
 
+static void gc_log(const char *kind, ucnum usec, alloc_bytes_t delta,
+                   ucnum heaps0, ucnum released0, ucnum finals0)
+{
+  ucnum marked = 0, heaps = 0;
+  int_ptr_t freed = 0;
+  int i;
+
+  for (i = 0; i < NUM_POOLS; i++) {
+    marked += pools[i].marked;
+    freed += pools[i].freed;
+    heaps += pools[i].heaps;
+  }
+
+  fprintf(stderr, "gc: %lu %s %luus malloc-delta %lu retained %lu "
+          "freed %ld heaps %lu (+%lu -%lu) finalized %lu\n",
+          convert(unsigned long, gc_stat.collections), kind,
+          convert(unsigned long, usec), convert(unsigned long, delta),
+          convert(unsigned long, marked), convert(long, freed),
+          convert(unsigned long, heaps),
+          convert(unsigned long, gc_stat.heaps_added - heaps0),
+          convert(unsigned long, gc_stat.heaps_released - released0),
+          convert(unsigned long, gc_stat.finals - finals0));
+}
+
 void gc(void)
 {
   val gc_stack_top = nil;
 #if CONFIG_GEN_GC
-  int exhausted = (free_list == 0);
   int full_gc_next_time = 0;
   static int gc_counter;
 #endif
-  int swept;
+  int i;
+  heap_t *heap;
   mach_context_t mc;
+  ucnum start = gc_usec(), usec;
+  alloc_bytes_t delta = malloc_bytes - prev_malloc_bytes;
+  ucnum heaps0 = gc_stat.heaps_added, finals0 = gc_stat.finals;
+  ucnum released0 = gc_stat.heaps_released;
+  const char *kind = "full";
 
   assert (gc_enabled);
 
   if (inprogress++)
     assert(0 && "gc re-entered");
 
+  prof_resolve();
+
 #if CONFIG_GEN_GC
-  if (malloc_bytes - prev_malloc_bytes >= opt_gc_delta)
-    full_gc = 1;
+  if (!mark_incr) {
+    if (malloc_bytes - prev_malloc_bytes >= opt_gc_delta && !full_gc) {
+      gc_cnt.full_delta++;
+      full_gc = 1;
+    }
+
+    if (full_gc)
+      gc_cnt.full++;
+    else
+      gc_cnt.minor++;
+  }
+
+  if (!full_gc)
+    kind = "minor";
 #endif
 
   save_context(mc);
   gc_enabled = 0;
+#if CONFIG_GEN_GC
+  if (mark_incr) {
+    mark_incr_finish();
+  } else {
+#endif
+    sweep_finish();
+    for (i = 0; i < NUM_POOLS; i++) {
+      pools[i].exhausted = (pools[i].free_list == 0);
+      pools[i].freed = 0;
+      pools[i].marked = 0;
+    }
+    for (heap = heap_list; heap != 0; heap = heap->next)
+      heap->marked = 0;
+#if CONFIG_GEN_GC
+    if (full_gc && opt_gc_pause_budget != 0 && mark_bitmap && !opt_gc_debug) {
+      mark_incr_start();
+      gc_enabled = 1;
+      prev_malloc_bytes = malloc_bytes;
+      inprogress--;
+      usec = gc_usec() - start;
+      pause_record(usec);
+      if (opt_gc_log)
+        gc_log("incremental", usec, delta, heaps0, released0, finals0);
+      return;
+    }
+  }
+#endif
   rcyc_empty();
   mark(&mc, &gc_stack_top);
   hash_process_weak();
   prepare_finals();
-  swept = sweep();
+  prof_weak();
+#if CONFIG_GEN_GC
+  if ((opt_gc_lazy_sweep || opt_gc_pause_budget != 0) && full_gc &&
+      mark_bitmap)
+#else
+  if (opt_gc_lazy_sweep && mark_bitmap)
+#endif
+    sweep_lazy_start();
+  else
+    sweep();
 #if CONFIG_GEN_GC
 #if 0
-  printf("sweep: freed %d full_gc == %d exhausted == %d\n",
-         (int) swept, full_gc, exhausted);
+  printf("sweep: freed %d/%d full_gc == %d\n",
+         (int) pools[OBJ_POOL].freed, (int) pools[CONS_POOL].freed, full_gc);
 #endif
-  if (++gc_counter >= FULL_GC_INTERVAL ||
-      freshobj_idx >= FRESHOBJ_VEC_SIZE)
-  {
+  if (freshobj_idx >= FRESHOBJ_VEC_SIZE) {
+    gc_cnt.full_fresh++;
+    full_gc_next_time = 1;
+    gc_counter = 0;
+  } else if (++gc_counter >= FULL_GC_INTERVAL) {
+    gc_cnt.full_interval++;
     full_gc_next_time = 1;
     gc_counter = 0;
   }
 
-  if (exhausted && full_gc && swept < 3 * HEAP_SIZE / 4)
-    more();
+  for (i = 0; i < NUM_POOLS; i++) {
+    struct pool *pool = &pools[i];
+    if (pool->exhausted && full_gc && pool->freed < 3 * pool->size / 4)
+      more(pool);
+  }
 #else
-  if (swept < 3 * HEAP_SIZE / 4)
-    more();
+  for (i = 0; i < NUM_POOLS; i++) {
+    struct pool *pool = &pools[i];
+    if (pool->freed < 3 * pool->size / 4)
+      more(pool);
+  }
 #endif
 
 #if CONFIG_GEN_GC
-  checkobj_idx = 0;
-  mutobj_idx = 0;
+  dirty_clear();
   freshobj_idx = 0;
   full_gc = full_gc_next_time;
 #endif
+  if (!sweep_next)
+    heap_release_retired();
   call_finals();
   gc_enabled = 1;
   prev_malloc_bytes = malloc_bytes;
 
   inprogress--;
+  usec = gc_usec() - start;
+  pause_record(usec);
+
+  gc_stat.collections++;
+  gc_stat.time += usec;
+  gc_stat.last_time = usec;
+  gc_stat.last_delta = delta;
+
+  if (opt_gc_log)
+    gc_log(kind, usec, delta, heaps0, released0, finals0);
 }
 
 int gc_state(int enabled)
@@ -831,17 +2104,13 @@ int gc_is_reachable(val obj)
 
 void gc_assign_check(val p, val c)
 {
-  if (p && is_ptr(c) && p->t.gen == 1 && c->t.gen == 0 && !full_gc) {
-    if (checkobj_idx < CHECKOBJ_VEC_SIZE) {
-      c->t.gen = -1;
-      checkobj[checkobj_idx++] = c;
-    } else if (gc_enabled) {
-      gc();
-      /* c can't be in gen 0 because there are no baby objects after gc */
-    } else {
-      /* We have no space to in checkobj record this backreference, and gc is
-         not available to promote obj to gen 1. We must schedule a full gc. */
-      full_gc = 1;
+  if (p && is_ptr(c) && p->t.gen == 1) {
+    if (mark_incr) {
+      if (marked_p(p))
+        mark_push(c);
+    } else if (c->t.gen == 0 && !full_gc) {
+      gc_cnt.barrier_set++;
+      dirty_obj(p);
     }
   }
 }
@@ -857,19 +2126,15 @@ val gc_mutated(val obj)
 {
   /* We care only about mature generation objects that have not
      already been noted. And if a full gc is coming, don't bother. */
-  if (full_gc || obj->t.gen <= 0)
+  if (mark_incr) {
+    if (obj->t.gen == 1 && marked_p(obj))
+      mark_regray(obj);
     return obj;
-  /* Store in mutobj array *before* triggering gc, otherwise
-     baby objects referenced by obj could be reclaimed! */
-  if (mutobj_idx < MUTOBJ_VEC_SIZE) {
-    obj->t.gen = -1;
-    mutobj[mutobj_idx++] = obj;
-  } else if (gc_enabled) {
-    gc();
-  } else {
-    full_gc = 1;
   }
-
+  if (full_gc || obj->t.gen <= 0)
+    return obj;
+  gc_cnt.barrier_mut++;
+  dirty_obj(obj);
   return obj;
 }
 
@@ -886,6 +2151,237 @@ static val gc_set_delta(val delta)
   return nil;
 }
 
+#if CONFIG_GEN_GC
+
+static val gc_counters(void)
+{
+  return list(intern(lit("minor"), keyword_package), unum(gc_cnt.minor),
+              intern(lit("full"), keyword_package), unum(gc_cnt.full),
+              intern(lit("barrier-set"), keyword_package),
+              unum(gc_cnt.barrier_set),
+              intern(lit("barrier-mutated"), keyword_package),
+              unum(gc_cnt.barrier_mut),
+              intern(lit("dirty-scanned"), keyword_package),
+              unum(gc_cnt.dirty_scanned),
+              intern(lit("full-delta"), keyword_package),
+              unum(gc_cnt.full_delta),
+              intern(lit("full-interval"), keyword_package),
+              unum(gc_cnt.full_interval),
+              intern(lit("full-nursery"), keyword_package),
+              unum(gc_cnt.full_fresh),
+              intern(lit("full-finalize"), keyword_package),
+              unum(gc_cnt.full_final),
+              intern(lit("incremental-steps"), keyword_package),
+              unum(gc_cnt.incr_steps),
+              nao);
+}
+
+#endif
+
+static val gc_type_alist(ucnum *counts)
+{
+  list_collect_decl(out, ptail);
+  int i;
+
+  for (i = 0; i <= MAXTYPE; i++)
+    if (counts[i] != 0)
+      ptail = list_collect(ptail, cons(code2type(i), unum(counts[i])));
+
+  return out;
+}
+
+static val gc_stats(void)
+{
+  ucnum heaps = 0;
+  int i;
+
+  for (i = 0; i < NUM_POOLS; i++)
+    heaps += pools[i].heaps;
+
+  return list(intern(lit("collections"), keyword_package),
+              unum(gc_stat.collections),
+              intern(lit("time"), keyword_package), unum(gc_stat.time),
+              intern(lit("last-time"), keyword_package),
+              unum(gc_stat.last_time),
+              intern(lit("last-malloc-delta"), keyword_package),
+              unum(gc_stat.last_delta),
+              intern(lit("malloc-delta"), keyword_package),
+              unum(malloc_bytes - prev_malloc_bytes),
+              intern(lit("heaps"), keyword_package), unum(heaps),
+              intern(lit("heap-bytes"), keyword_package),
+              unum(heaps * HEAP_ARENA_SIZE),
+              intern(lit("heaps-added"), keyword_package),
+              unum(gc_stat.heaps_added),
+              intern(lit("heaps-released"), keyword_package),
+              unum(gc_stat.heaps_released),
+              intern(lit("finalized"), keyword_package), unum(gc_stat.finals),
+              intern(lit("freed"), keyword_package),
+              gc_type_alist(gc_stat.freed),
+              intern(lit("retained"), keyword_package),
+              gc_type_alist(gc_stat.retained),
+              nao);
+}
+
+static val prof_frame_name(struct prof_frame *pf, val cache)
+{
+  val name, fname;
+
+  if (!pf->fun)
+    return lit("toplevel");
+
+  if (pf->fun == lambda_s)
+    return lit("(lambda)");
+
+  if ((name = gethash(cache, pf->fun)))
+    return name;
+
+  fname = func_get_name(pf->fun, nil);
+
+  if (consp(fname) && car(fname) == lambda_s)
+    fname = nil;
+
+  name = if3(fname, format(nil, lit("~s"), fname, nao), lit("(lambda)"));
+  /* In the collapsed report, a stack is one line with the frames separated
+     by semicolons; long names are printed on several lines. */
+  name = cat_str(mapcar(func_n1(trim_str), split_str(name, lit("\n"))),
+                 lit(" "));
+  name = cat_str(split_str(name, lit(";")), lit(":"));
+  sethash(cache, pf->fun, name);
+  return name;
+}
+
+static val prof_type_name(int t)
+{
+  return if3(t == PROF_MALLOC, lit("malloc"), symbol_name(code2type(t)));
+}
+
+static void prof_report_site(struct prof_site *site, val stream,
+                             val collapsed, val cache, val flat)
+{
+  uses_or2;
+  list_collect_decl(frames, ptail);
+  int i, t;
+
+  if (collapsed)
+    for (i = site->depth - 1; i >= 0; i--)
+      ptail = list_collect(ptail, prof_frame_name(&site->frame[i], cache));
+
+  for (t = 0; t <= PROF_MALLOC; t++) {
+    if (site->bytes[t] == 0)
+      continue;
+
+    if (collapsed) {
+      val stack = append2(frames, cons(prof_type_name(t), nil));
+      format(stream, lit("~a ~a\n"), cat_str(stack, lit(";")),
+             unum(site->bytes[t]), nao);
+    } else {
+      val leaf = if3(site->depth > 0,
+                     prof_frame_name(&site->frame[0], cache), lit("-"));
+      val key = cons(leaf, prof_type_name(t));
+      val cell = gethash_c(lit("alloc-prof-report"), flat, key, nulloc);
+      rplacd(cell, plus(or2(cdr(cell), zero), unum(site->bytes[t])));
+    }
+  }
+}
+
+val gc_prof_report(val stream, val collapsed)
+{
+  val cache = make_hash(nil, nil, nil);
+  val flat = make_hash(nil, nil, t);
+  ucnum i;
+
+  stream = default_arg(stream, std_output);
+  collapsed = default_null_arg(collapsed);
+
+  prof_resolve();
+
+  uw_simple_catch_begin;
+
+  prof_busy = 1;
+
+  for (i = 0; prof_tab && i <= prof_tab_mask; i++)
+    if (prof_tab[i])
+      prof_report_site(prof_tab[i], stream, collapsed, cache, flat);
+
+  if (!collapsed) {
+    val rows = sort(hash_alist(flat), greater_f, cdr_f);
+
+    format(stream, lit("~12a  ~<8a ~a\n"),
+           lit("bytes"), lit("type"), lit("function"), nao);
+
+    for (; rows; rows = cdr(rows)) {
+      val row = car(rows);
+      format(stream, lit("~12a  ~<8a ~a\n"),
+             cdr(row), cdr(car(row)), car(car(row)), nao);
+    }
+  }
+
+  uw_unwind {
+    prof_busy = 0;
+  }
+
+  uw_catch_end;
+
+  return nil;
+}
+
+static val gc_prof_set_period(val bytes)
+{
+  val old = unum(alloc_prof_period);
+  alloc_prof_period = if3(bytes, c_unum(bytes), 0);
+  prof_left = alloc_prof_period;
+  return old;
+}
+
+static val gc_prof_reset(void)
+{
+  prof_free();
+  return nil;
+}
+
+static val gc_set_pause_budget(val usec)
+{
+  val old = unum(opt_gc_pause_budget);
+  opt_gc_pause_budget = if3(usec, c_unum(usec), 0);
+  if (opt_gc_pause_budget != 0)
+    gc_set_mark_bitmap(1);
+  return old;
+}
+
+static val gc_set_heap_slack(val percent)
+{
+  val old = if2(opt_gc_heap_slack >= 0, num(opt_gc_heap_slack));
+  opt_gc_heap_slack = if3(percent, c_num(percent), -1);
+  return old;
+}
+
+static val gc_pause_stats(val reset)
+{
+  list_collect_decl(hist, ptail);
+  int top, b;
+  val ret;
+
+  for (top = PAUSE_BUCKETS; top > 0 && gc_pauses.hist[top - 1] == 0; top--)
+    ; /* empty */
+
+  for (b = 0; b < top; b++) {
+    val limit = if3(b < PAUSE_BUCKETS - 1,
+                    unum(convert(ucnum, 1) << b), t);
+    ptail = list_collect(ptail, cons(limit, unum(gc_pauses.hist[b])));
+  }
+
+  ret = list(intern(lit("count"), keyword_package), unum(gc_pauses.count),
+             intern(lit("total"), keyword_package), unum(gc_pauses.total),
+             intern(lit("max"), keyword_package), unum(gc_pauses.max),
+             intern(lit("histogram"), keyword_package), hist,
+             nao);
+
+  if (default_null_arg(reset))
+    memset(&gc_pauses, 0, sizeof gc_pauses);
+
+  return ret;
+}
+
 static val gc_wrap(void)
 {
   if (gc_enabled) {
@@ -939,6 +2435,9 @@ val valid_object_p(val obj)
   if (!in_heap(obj))
     return nil;
 
+  if (!inprogress)
+    sweep_finish();
+
   if (obj->t.type & (REACHABLE | FREE))
     return nil;
 
@@ -949,6 +2448,22 @@ void gc_late_init(void)
 {
   reg_fun(intern(lit("gc"), system_package), func_n0(gc_wrap));
   reg_fun(intern(lit("gc-set-delta"), system_package), func_n1(gc_set_delta));
+#if CONFIG_GEN_GC
+  reg_fun(intern(lit("gc-counters"), system_package), func_n0(gc_counters));
+#endif
+  reg_fun(intern(lit("gc-stats"), system_package), func_n0(gc_stats));
+  reg_fun(intern(lit("alloc-prof-set-period"), system_package),
+          func_n1(gc_prof_set_period));
+  reg_fun(intern(lit("alloc-prof-report"), system_package),
+          func_n2o(gc_prof_report, 0));
+  reg_fun(intern(lit("alloc-prof-reset"), system_package),
+          func_n0(gc_prof_reset));
+  reg_fun(intern(lit("gc-set-pause-budget"), system_package),
+          func_n1(gc_set_pause_budget));
+  reg_fun(intern(lit("gc-set-heap-slack"), system_package),
+          func_n1(gc_set_heap_slack));
+  reg_fun(intern(lit("gc-pauses"), system_package),
+          func_n1o(gc_pause_stats, 0));
   reg_fun(intern(lit("finalize"), user_package), func_n3o(gc_finalize, 2));
   reg_fun(intern(lit("call-finalizers"), user_package),
           func_n1(gc_call_finalizers));
@@ -962,24 +2477,33 @@ void unmark(void)
   heap_t *heap;
 
   for (heap = heap_list; heap != 0; heap = heap->next) {
+    size_t cell = heap->pool->cell;
     val block, end;
-    for (block = heap->block, end = heap->block + HEAP_SIZE;
+    for (block = heap->block, end = heap->end;
          block < end;
-         block++)
+         block = heap_succ(block, cell))
     {
-      block->t.type = convert(type_t, block->t.type & ~REACHABLE);
+      block->t.type = convert(type_t,
+                              block->t.type & ~(REACHABLE | MARK_PENDING));
     }
+
+    memset(heap->marks, 0, sizeof heap->marks);
   }
 }
 
 void gc_cancel(void)
 {
   unmark();
+  sweep_next = 0;
+  mark_stack_top = 0;
+  mark_pending = 0;
+  mark_draining = 0;
 #if CONFIG_GEN_GC
-  checkobj_idx = 0;
-  mutobj_idx = 0;
+  dirty_clear();
   freshobj_idx = 0;
+  freshobj_ovf_free();
   full_gc = 1;
+  mark_incr = 0;
 #endif
   inprogress = 0;
 }
@@ -990,7 +2514,9 @@ void dheap(heap_t *heap, int start, int end)
 {
   int i;
   for (i = start; i < end; i++)
-    format(std_output, lit("(~a ~s)\n"), num(i), &heap->block[i], nao);
+    format(std_output, lit("(~a ~s)\n"), num(i),
+           coerce(val, coerce(mem_t *, heap->block) + i * heap->pool->cell),
+           nao);
 }
 
 /*
@@ -1030,16 +2556,17 @@ void gc_free_all(void)
 
     while (iter) {
       heap_t *next = iter->next;
+      size_t cell = iter->pool->cell;
       obj_t *block, *end;
 
 #if HAVE_VALGRIND
       if (opt_vg_debug)
-        VALGRIND_MAKE_MEM_DEFINED(&iter->block, sizeof iter->block);
+        VALGRIND_MAKE_MEM_DEFINED(iter->block, heap_bytes(iter));
 #endif
 
-      for (block = iter->block, end = iter->block + HEAP_SIZE;
+      for (block = iter->block, end = iter->end;
            block < end;
-           block++)
+           block = heap_succ(block, cell))
       {
         type_t t = block->t.type;
         if ((t & FREE) != 0)
@@ -1047,9 +2574,16 @@ void gc_free_all(void)
         finalize(block);
       }
 
+      arena_free(iter);
       free(iter);
       iter = next;
     }
+
+    free(arena_map);
+    arena_map = 0;
+    free(mark_stack);
+    mark_stack = 0;
+    prof_free();
   }
 
   {
@@ -30,6 +30,7 @@ void gc_late_init(void);
 val prot1(val *loc);
 void protect(val *, ...);
 val make_obj(void);
+val make_cons_obj(void);
 void gc(void);
 int gc_state(int);
 int gc_inprogress(void);
@@ -37,7 +38,10 @@ void gc_mark(val);
 void gc_conservative_mark(val);
 void gc_mark_mem(val *low, val *high);
 int gc_is_reachable(val);
+void gc_set_mark_bitmap(int on);
 val gc_finalize(val obj, val fun, val rev_order_p);
+void gc_prof_malloc(size_t size);
+val gc_prof_report(val stream, val collapsed);
 val gc_call_finalizers(val obj);
 
 #if CONFIG_GEN_GC
@@ -58,6 +62,25 @@ void gc_free_all(void);
 
 extern int gc_enabled;
 extern val **gc_prot_top;
+extern ucnum alloc_prof_period;
+
+/*
+ * Frames of Lisp function calls, linked through the C stack for the
+ * allocation profiler. The chain is restored by non-local exits.
+ */
+struct prof_frame {
+  struct prof_frame *up;
+  val fun;
+  val code;
+  unsigned ip;
+};
+
+extern struct prof_frame *prof_top;
+
+#define prof_frame_push(pf, fn, cd, pc)                         \
+  ((pf)->up = prof_top, (pf)->fun = (fn), (pf)->code = (cd),    \
+   (pf)->ip = (pc), prof_top = (pf))
+#define prof_frame_pop(pf) (prof_top = (pf)->up)
 
 #if CONFIG_EXTRA_DEBUGGING
 extern val break_obj;
@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
 #include <limits.h>
 #include <signal.h>
 #include "config.h"
@@ -46,7 +48,9 @@
 #include "eval.h"
 #include "itypes.h"
 #include "arith.h"
+#include "sysif.h"
 #include "hash.h"
+#include "cdb.h"
 
 typedef enum hash_flags {
   hash_weak_none = 0,
@@ -59,45 +63,131 @@ struct hash_ops {
   ucnum (*hash_fun)(val, int *, ucnum);
   val (*equal_fun)(val, val);
   val (*assoc_fun)(val key, cnum hash, val list);
-  val (*acons_new_c_fun)(val key, cnum hash, loc new_p, loc list);
 };
 
-#define hash_ops_init(hash, equal, assoc, acons) \
-  { hash, equal, assoc, acons }
+#define hash_ops_init(hash, equal, assoc) \
+  { hash, equal, assoc }
 
+/*
+ * The table is a vector of 2 * size elements, size being a power of two.
+ * Each slot is a pair of elements: the entry's hash code as a fixnum,
+ * followed by the entry. In an empty slot, both are nil; in a slot whose
+ * entry has been deleted, the entry is t. Collisions are resolved by linear
+ * probing. The cached hash codes are compared before any entry is touched,
+ * so a probe past keys that are not equal rarely leaves the table.
+ * The used count includes the deleted slots, which are reclaimed only when
+ * the table is rebuilt.
+ *
+ * A table is rebuilt incrementally. A new table is allocated, and the old
+ * one is kept as old_table while its slots are copied over, at most
+ * HASH_MIGRATE_STEP slots for every operation on the hash, in order of
+ * increasing index; migrate is the index of the next slot to be copied.
+ * The old table is not otherwise changed, except that deletions are applied
+ * to both tables. So an entry is either in the new table, or only in the
+ * part of the old table which is yet to be migrated. The count covers
+ * the entries of both tables, each entry once.
+ *
+ * Iterators walk the table vector which was current when they began, and
+ * the part of the old table which was yet to be migrated; beginning an
+ * iteration does not complete a rebuild. While any iterators exist,
+ * growing is put off until the table is 15/16 full. A table which is
+ * replaced, or an old table whose migration is completed, while there
+ * are iterators is kept on the iter_tables list, and deletions are applied
+ * to it as well, so that the iterators do not return deleted entries.
+ *
+ * An ordered table has an index, and its table is laid out differently.
+ * The entries are stored in the table densely, in order of insertion:
+ * used is the number of slots which have been filled, and the slots
+ * beyond that are empty. A deleted entry leaves a hole (a slot with a nil
+ * code and a t entry) until the table is compacted. The index is an open
+ * addressing table of 2 * size elements holding the table positions of
+ * the entries plus one, or zero in unused elements, probed linearly from
+ * the hash code. An index element which refers to a hole is simply
+ * skipped, so there is nothing to delete from the index. Iteration walks
+ * the table, and so visits the entries in insertion order. An ordered
+ * table is always rebuilt all at once; it never has an old table.
+ */
 struct hash {
   ucnum seed;
   hash_flags_t flags;
   struct hash *next;
+  struct hash *used_next;
   val table;
-  cnum modulus;
+  cnum size;
   cnum count;
+  cnum used;
+  val old_table;
+  cnum old_size;
+  cnum migrate;
+  val iter_tables;
   val userdata;
   int usecount;
   struct hash_ops *hops;
+  u32_t *index;
 };
 
+/*
+ * An iterator holds on to the table that it is traversing. If the table
+ * is replaced during the iteration, the iterator carries on through the
+ * old table, which continues to reflect deletions.
+ *
+ * If the table is being rebuilt when the iteration begins, the iterator
+ * first walks the part of the old table which is yet to be migrated, from
+ * migrate onward, and then the new table. In the new table, it skips the
+ * entries which are also in that part of the old table, having already
+ * visited them.
+ */
 struct hash_iter {
   struct hash_iter *next;
   val hash;
-  cnum chain;
-  val cons;
+  val table;
+  cnum index;
+  val old_table;
+  cnum old_index;
+  cnum migrate;
 };
 
+#define HASH_INIT_SIZE 128
+#define HASH_MIN_SIZE 8
+#define HASH_MIGRATE_STEP 16
+#define STR_HASH_CACHE_SIZE 1024
+#define STR_HASH_CACHE_MIN 16
+
 #define hash_seed (deref(lookup_var_l(nil, hash_seed_s)))
 
 static_forward(struct hash_ops hash_eql_ops);
 static_forward(struct hash_ops hash_equal_ops);
+static_forward(struct cobj_ops hamt_iter_ops);
+
+static val hamt_begin(val hamt);
+static val hamt_next(val iter);
 
 val weak_keys_k, weak_vals_k, equal_based_k, eql_based_k, userdata_k;
+val ordered_k;
 val hash_seed_s;
 
 /*
  * Dynamic lists built up during gc.
  */
 static struct hash *reachable_weak_hashes;
+static struct hash *reachable_used_hashes;
 static struct hash_iter *reachable_iters;
 
+/*
+ * The entries of weak tables whose weak parts were not known to be
+ * reachable when the table was marked. Only these entries can turn out
+ * to be garbage, so only these are examined after marking. If the array
+ * cannot be grown, the entries which don't fit are handled by having
+ * their strong parts marked unconditionally, and by weak processing
+ * falling back on examining every entry of every table.
+ */
+static struct weak_pending {
+  struct hash *h;
+  val entry;
+} *weak_pending;
+static cnum weak_pending_count, weak_pending_size;
+static int weak_pending_lost;
+
 static int hash_str_limit = INT_MAX, hash_rec_limit = 32;
 
 /* C99 inline instantiations. */
@@ -112,27 +202,93 @@ static u32_t randbox[] = {
   0x69232f74U, 0xfead7bb3U, 0xe9089ab6U, 0xf012f6aeU,
 };
 
-static u32_t hash_c_str(const wchar_t *str, u32_t seed)
+INLINE u32_t hash_mix(u32_t acc, u32_t in)
 {
-  int count = hash_str_limit;
-  u32_t acc = seed;
-  u32_t ch;
+  in *= 0xcc9e2d51U;
+  in = in << 15 | in >> (32 - 15);
+  in *= 0x1b873593U;
+  acc ^= in;
+  acc = acc << 13 | acc >> (32 - 13);
+  return acc * 5 + 0xe6546b64U;
+}
 
-  while (count-- && (ch = *str++) != 0) {
-    acc ^= ch;
-    acc ^= randbox[acc & 0xf];
-    acc = acc >> 1 | acc << (32 - 1);
+/*
+ * Hash len characters of a wide string. The characters are taken two at a
+ * time into two independent accumulators, so that the multiplications of
+ * consecutive characters can overlap.
+ */
+static u32_t hash_wstr(const wchar_t *str, cnum len, u32_t seed)
+{
+  u32_t acc0 = seed, acc1 = seed ^ 0x9e3779b9U;
+  const wchar_t *end;
+
+  if (len > hash_str_limit)
+    len = hash_str_limit;
+
+  end = str + (len & ~convert(cnum, 1));
+
+  for (; str < end; str += 2) {
+    acc0 = hash_mix(acc0, str[0]);
+    acc1 = hash_mix(acc1, str[1]);
   }
 
-  acc ^= randbox[acc & 0xf];
-  acc = acc >> 1 | acc << (32 - 1);
-  acc ^= randbox[acc & 0xf];
-  acc = acc >> 1 | acc << (32 - 1);
-  acc ^= randbox[acc & 0xf];
-  acc = acc >> 1 | acc << (32 - 1);
-  acc ^= randbox[acc & 0xf];
+  if (len & 1)
+    acc0 = hash_mix(acc0, str[0]);
 
-  return acc;
+  acc0 ^= (acc1 << 16 | acc1 >> 16) ^ convert(u32_t, len);
+  acc0 ^= acc0 >> 16;
+  acc0 *= 0x85ebca6bU;
+  acc0 ^= acc0 >> 13;
+  acc0 *= 0xc2b2ae35U;
+  acc0 ^= acc0 >> 16;
+
+  return acc0;
+}
+
+/*
+ * The hash codes of recently hashed strings which are long enough for it
+ * to matter are remembered in a small direct-mapped cache, keyed by the
+ * identity of the string object and the seed. The functions which modify
+ * strings, and the garbage collector when it frees one, invalidate the
+ * string's entry.
+ */
+static struct str_hash_cache {
+  val str;
+  u32_t seed;
+  u32_t hash;
+} str_hash_cache[STR_HASH_CACHE_SIZE];
+
+INLINE struct str_hash_cache *str_hash_slot(val str)
+{
+  ucnum i = coerce(uint_ptr_t, str) / sizeof (obj_t);
+  return &str_hash_cache[i % STR_HASH_CACHE_SIZE];
+}
+
+static u32_t hash_str(val str, u32_t seed)
+{
+  cnum len = c_num(length_str(str));
+  struct str_hash_cache *c;
+
+  if (len < STR_HASH_CACHE_MIN)
+    return hash_wstr(str->st.str, len, seed);
+
+  c = str_hash_slot(str);
+
+  if (c->str != str || c->seed != seed) {
+    c->hash = hash_wstr(str->st.str, len, seed);
+    c->seed = seed;
+    c->str = str;
+  }
+
+  return c->hash;
+}
+
+void str_hash_invalidate(val str)
+{
+  struct str_hash_cache *c = str_hash_slot(str);
+
+  if (c->str == str)
+    c->str = 0;
 }
 
 static u32_t hash_buf(const mem_t *ptr, ucnum size, u32_t seed)
@@ -203,12 +359,15 @@ ucnum equal_hash(val obj, int *count, ucnum seed)
   case NIL:
     return convert(ucnum, -1);
   case LIT:
-    return hash_c_str(litptr(obj), seed);
+    {
+      const wchar_t *str = litptr(obj);
+      return hash_wstr(str, wcslen(str), seed);
+    }
   case CONS:
     return equal_hash(obj->c.car, count, seed)
             + 2 * equal_hash(obj->c.cdr, count, seed);
   case STR:
-    return hash_c_str(obj->st.str, seed);
+    return hash_str(obj, seed);
   case CHR:
     return c_chr(obj);
   case NUM:
@@ -484,6 +643,12 @@ static void hash_print_op(val hash, val out, val pretty, struct strm_ctx *ctx)
       break;
     }
   }
+  if (h->index) {
+    if (need_space)
+      put_char(chr(' '), out);
+    need_space = 1;
+    obj_print_impl(ordered_k, out, pretty, ctx);
+  }
   if (h->userdata) {
     if (need_space)
       put_char(chr(' '), out);
@@ -520,96 +685,136 @@ static void hash_print_op(val hash, val out, val pretty, struct strm_ctx *ctx)
   set_indent(out, save_indent);
 }
 
+INLINE int hash_live_p(val entry)
+{
+  return entry != nil && entry != t;
+}
+
+static int weak_pending_add(struct hash *h, val entry)
+{
+  if (weak_pending_count == weak_pending_size) {
+    cnum new_size = if3(weak_pending_size, 2 * weak_pending_size, 256);
+    struct weak_pending *np = coerce(struct weak_pending *,
+                                     realloc(weak_pending,
+                                             new_size * sizeof *np));
+    if (np == 0) {
+      weak_pending_lost = 1;
+      return 0;
+    }
+
+    weak_pending = np;
+    weak_pending_size = new_size;
+  }
+
+  weak_pending[weak_pending_count].h = h;
+  weak_pending[weak_pending_count++].entry = entry;
+  return 1;
+}
+
+/*
+ * Mark what an entry of a weak table holds strongly, and record the entry
+ * as pending if its weak part is not yet known to be reachable.
+ * The value of an entry with a weak key is held strongly only while the
+ * key is reachable, like an ephemeron: a value which refers to its own key
+ * does not keep the entry alive. So the value is marked now if the key is
+ * already marked, and otherwise left to do_ephemerons.
+ */
+static void weak_entry_scan(struct hash *h, val entry)
+{
+  switch (h->flags) {
+  case hash_weak_none:
+    break;
+  case hash_weak_keys:
+    if (gc_is_reachable(us_car(entry)) || !weak_pending_add(h, entry))
+      gc_mark(us_cdr(entry));
+    break;
+  case hash_weak_vals:
+    gc_mark(us_car(entry));
+    if (!gc_is_reachable(us_cdr(entry)))
+      (void) weak_pending_add(h, entry);
+    break;
+  case hash_weak_both:
+    if (!gc_is_reachable(us_car(entry)) || !gc_is_reachable(us_cdr(entry)))
+      (void) weak_pending_add(h, entry);
+    break;
+  }
+}
+
 static void hash_mark(val hash)
 {
   struct hash *h = coerce(struct hash *, hash->co.handle);
+  val *vec = h->table->v.vec;
+  val *old = if3(h->old_table, h->old_table->v.vec, 0);
   cnum i;
 
   gc_mark(h->userdata);
 
-  /* Use counts will be re-calculated by a scan of the
-     hash iterators which are still reachable. */
-  h->usecount = 0;
+  /* Use counts will be re-calculated by a scan of the hash iterators
+     which are still reachable, once marking is complete. They are not
+     reset here, because an incremental cycle returns to the mutator,
+     which goes on iterating. */
+  if (h->usecount > 0) {
+    h->used_next = reachable_used_hashes;
+    reachable_used_hashes = h;
+  }
 
   switch (h->flags) {
   case hash_weak_none:
     /* If the hash is not weak, we can simply mark the table
-       vector and we are done. */
+       vectors and we are done. */
     gc_mark(h->table);
+    gc_mark(h->old_table);
+    gc_mark(h->iter_tables);
     break;
   case hash_weak_keys:
-    /* Keys are weak: mark the values only. */
-    for (i = 0; i < h->modulus; i++) {
-      val ind = num_fast(i);
-      val chain = vecref(h->table, ind);
-      val iter;
-
-      for (iter = chain; iter != nil; iter = us_cdr(iter)) {
-        val entry = us_car(iter);
-        gc_mark(us_cdr(entry));
-      }
-    }
-    h->next = reachable_weak_hashes;
-    reachable_weak_hashes = h;
-    break;
   case hash_weak_vals:
-    /* Values are weak: mark the keys only. */
-
-    for (i = 0; i < h->modulus; i++) {
-      val ind = num_fast(i);
-      val chain = vecref(h->table, ind);
-      val iter;
-
-      for (iter = chain; iter != nil; iter = us_cdr(iter)) {
-        val entry = us_car(iter);
-        gc_mark(us_car(entry));
-      }
-    }
-    h->next = reachable_weak_hashes;
-    reachable_weak_hashes = h;
-    break;
   case hash_weak_both:
-    /* Values and keys are weak: don't mark anything. */
+    for (i = 0; i < h->size; i++) {
+      val entry = vec[2 * i + 1];
+      if (hash_live_p(entry))
+        weak_entry_scan(h, entry);
+    }
+    for (i = h->migrate; i < h->old_size; i++) {
+      val entry = old[2 * i + 1];
+      if (hash_live_p(entry))
+        weak_entry_scan(h, entry);
+    }
     h->next = reachable_weak_hashes;
     reachable_weak_hashes = h;
     break;
   }
 }
 
+static void hash_destroy(val hash)
+{
+  struct hash *h = coerce(struct hash *, hash->co.handle);
+  free(h->index);
+  free(h);
+}
+
 static struct cobj_ops hash_ops = cobj_ops_init(hash_equal_op,
                                                 hash_print_op,
-                                                cobj_destroy_free_op,
+                                                hash_destroy,
                                                 hash_mark,
                                                 hash_hash_op);
 
-static void hash_grow(struct hash *h, val hash)
+INLINE val hash_code(cnum hv)
 {
-  cnum i;
-  cnum new_modulus = 2 * h->modulus;
-  val new_table;
-
-  if (new_modulus > NUM_MAX)
-    return;
-
-  new_table = vector(num_fast(new_modulus), nil);
-
-  for (i = 0; i < h->modulus; i++) {
-    val conses = vecref(h->table, num_fast(i));
-
-    while (conses) {
-      val entry = us_car(conses);
-      val next = us_cdr(conses);
-      loc pchain = vecref_l(new_table,
-                            num_fast(entry->ch.hash % new_modulus));
-      us_rplacd(conses, deref(pchain));
-      set(pchain, conses);
-      conses = next;
-    }
-  }
+  return num_fast(hv & NUM_MAX);
+}
 
-  h->modulus = new_modulus;
-  h->table = new_table;
-  setcheck(hash, new_table);
+/*
+ * Hash entries are conses which carry the hash code in an extra field, so
+ * they cannot come from the compact cons heap used by cons.
+ */
+static val make_hash_entry(val key, val value, cnum hash)
+{
+  val entry = make_obj();
+  entry->ch.type = CONS;
+  entry->ch.car = key;
+  entry->ch.cdr = value;
+  entry->ch.hash = hash;
+  return entry;
 }
 
 static val hash_assoc(val key, cnum hash, val list)
@@ -636,208 +841,583 @@ static val hash_assql(val key, cnum hash, val list)
   return nil;
 }
 
-static val hash_acons_new_c(val key, cnum hash, loc new_p, loc list)
+static cnum table_lookup(val table, cnum size, val (*equal_fun)(val, val),
+                         val key, cnum hv)
 {
-  val existing = hash_assoc(key, hash, deref(list));
+  val *vec = table->v.vec;
+  ucnum mask = size - 1;
+  ucnum i = hv & mask;
+  val code = hash_code(hv);
 
-  if (existing) {
-    if (!nullocp(new_p))
-      deref(new_p) = nil;
-    return existing;
-  } else {
-    val nc = cons(key, nil);
-    nc->ch.hash = hash;
-    set(list, cons(nc, deref(list)));
-    if (!nullocp(new_p))
-      deref(new_p) = t;
-    return nc;
+  for (;; i = (i + 1) & mask) {
+    val entry = vec[2 * i + 1];
+
+    if (entry == nil)
+      return -1;
+
+    if (vec[2 * i] == code) {
+      val ekey = us_car(entry);
+      if (ekey == key || equal_fun(ekey, key))
+        return i;
+    }
   }
 }
 
-static val hash_aconsql_new_c(val key, cnum hash, loc new_p, loc list)
+static cnum ordered_lookup(struct hash *h, val key, cnum hv)
 {
-  val existing = hash_assql(key, hash, deref(list));
+  val *vec = h->table->v.vec;
+  ucnum mask = 2 * h->size - 1;
+  ucnum i = hv & mask;
+  val code = hash_code(hv);
+  u32_t ix;
 
-  if (existing) {
-    if (!nullocp(new_p))
-      deref(new_p) = nil;
-    return existing;
-  } else {
-    val nc = cons(key, nil);
-    nc->ch.hash = hash;
-    set(list, cons(nc, deref(list)));
-    if (!nullocp(new_p))
-      deref(new_p) = t;
-    return nc;
-  }
-}
+  for (; (ix = h->index[i]) != 0; i = (i + 1) & mask) {
+    cnum pos = ix - 1;
 
-static_def(struct hash_ops hash_eql_ops = hash_ops_init(eql_hash_op, eql,
-                                                        hash_assql,
-                                                        hash_aconsql_new_c));
+    if (vec[2 * pos] == code) {
+      val ekey = us_car(vec[2 * pos + 1]);
+      if (ekey == key || h->hops->equal_fun(ekey, key))
+        return pos;
+    }
+  }
 
-static_def(struct hash_ops hash_equal_ops = hash_ops_init(equal_hash, equal,
-                                                          hash_assoc,
-                                                          hash_acons_new_c));
+  return -1;
+}
 
-val make_seeded_hash(val weak_keys, val weak_vals, val equal_based, val seed)
+/*
+ * Delete the entry in slot i. If the next slot is empty, no probe
+ * sequence passes through slot i, and so it becomes empty too; the
+ * return value indicates this.
+ */
+static int table_delete(val table, cnum size, cnum i)
 {
-  if (weak_keys && equal_based) {
-    uw_throwf(error_s,
-              lit("make-hash: bad combination :weak-keys with :equal-based"),
-              nao);
-  } else {
-    int flags = ((weak_vals != nil) << 1) | (weak_keys != nil);
-    struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
-    val mod = num_fast(256);
-    val table = vector(mod, nil);
-    val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
-
-    h->seed = convert(u32_t, c_unum(default_arg(seed,
-                                                if3(hash_seed_s,
-                                                    hash_seed, zero))));
-    h->flags = convert(hash_flags_t, flags);
-    h->modulus = c_num(mod);
-    h->count = 0;
-    h->table = table;
-    h->userdata = nil;
+  val *vec = table->v.vec;
+  ucnum mask = size - 1;
 
-    h->usecount = 0;
-    h->hops = equal_based ? &hash_equal_ops : &hash_eql_ops;
+  vec[2 * i] = nil;
 
-    return hash;
+  if (vec[2 * ((i + 1) & mask) + 1] == nil) {
+    vec[2 * i + 1] = nil;
+    return 1;
   }
+
+  vec[2 * i + 1] = t;
+  return 0;
 }
 
-val make_hash(val weak_keys, val weak_vals, val equal_based)
+/*
+ * Delete the entry in slot i of the current table of h.
+ */
+static void hash_delete_slot(struct hash *h, cnum i)
 {
-  return make_seeded_hash(weak_keys, weak_vals, equal_based, nil);
+  if (h->index) {
+    h->table->v.vec[2 * i] = nil;
+    h->table->v.vec[2 * i + 1] = t;
+  } else {
+    h->used -= table_delete(h->table, h->size, i);
+  }
 }
 
-val make_similar_hash(val existing)
+static void table_store(struct hash *h, val entry, val code)
 {
-  val self = lit("make-similar-hash");
-  struct hash *ex = coerce(struct hash *, cobj_handle(self, existing, hash_s));
-  struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
-  val mod = num_fast(256);
-  val table = vector(mod, nil);
-  val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
+  val *vec = h->table->v.vec;
+  ucnum mask = h->size - 1;
+  ucnum i;
 
-  h->modulus = c_num(mod);
-  h->count = 0;
-  h->table = table;
-  h->userdata = ex->userdata;
+  if (h->index) {
+    ucnum pos = h->used++;
 
-  h->seed = ex->seed;
-  h->flags = ex->flags;
-  h->usecount = 0;
-  h->hops = ex->hops;
+    vec[2 * pos] = code;
+    set(mkloc(vec[2 * pos + 1], h->table), entry);
 
-  return hash;
-}
+    mask = 2 * h->size - 1;
 
-static val copy_hash_chain(val chain)
-{
-  list_collect_decl(out, ptail);
+    for (i = c_n(code) & mask; h->index[i] != 0; i = (i + 1) & mask)
+      ; /* empty */
 
-  for (; chain; chain = us_cdr(chain)) {
-    val entry = us_car(chain);
-    val nentry = cons(us_car(entry), us_cdr(entry));
-    nentry->ch.hash = entry->ch.hash;
-    ptail = list_collect(ptail, nentry);
+    h->index[i] = pos + 1;
+    return;
   }
 
-  return out;
+  for (i = c_n(code) & mask; hash_live_p(vec[2 * i + 1]); i = (i + 1) & mask)
+    ; /* empty */
+
+  if (vec[2 * i + 1] == nil)
+    h->used++;
+
+  vec[2 * i] = code;
+  set(mkloc(vec[2 * i + 1], h->table), entry);
 }
 
-val copy_hash(val existing)
+static void hash_migrate(struct hash *h, val hash, cnum steps)
 {
-  val self = lit("copy-hash");
-  struct hash *ex = coerce(struct hash *, cobj_handle(self, existing, hash_s));
-  struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
-  val mod = num_fast(ex->modulus);
-  val table = vector(mod, nil);
-  val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
-  val iter;
+  val *old;
 
-  h->modulus = ex->modulus;
-  h->count = ex->count;
-  h->table = table;
-  h->userdata = ex->userdata;
+  if (!h->old_table)
+    return;
 
-  h->seed = ex->seed;
-  h->flags = ex->flags;
-  h->usecount = 0;
-  h->hops = ex->hops;
+  old = h->old_table->v.vec;
 
-  for (iter = zero; lt(iter, mod); iter = plus(iter, one))
-    set(vecref_l(h->table, iter), copy_hash_chain(vecref(ex->table, iter)));
+  while (steps-- > 0 && h->migrate < h->old_size) {
+    cnum i = h->migrate++;
+    val entry = old[2 * i + 1];
 
-  return hash;
-}
+    if (hash_live_p(entry))
+      table_store(h, entry, old[2 * i]);
+  }
 
-val gethash_c(val self, val hash, val key, loc new_p)
-{
-  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
-  int lim = hash_rec_limit;
-  cnum hv = h->hops->hash_fun(key, &lim, h->seed);
-  loc pchain = vecref_l(h->table, num_fast(hv % h->modulus));
-  val old = deref(pchain);
-  val cell = h->hops->acons_new_c_fun(key, hv, new_p, pchain);
-  if (old != deref(pchain) && ++h->count > 2 * h->modulus && h->usecount == 0)
-    hash_grow(h, hash);
-  return cell;
+  if (h->migrate >= h->old_size) {
+    /* An iterator may still be walking the old table. */
+    if (h->usecount > 0)
+      mpush(h->old_table, mkloc(h->iter_tables, hash));
+    h->old_table = nil;
+    h->old_size = h->migrate = 0;
+  }
 }
 
-val gethash_e(val self, val hash, val key)
+static void hash_migrate_all(struct hash *h, val hash)
 {
-  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
-  int lim = hash_rec_limit;
-  cnum hv = h->hops->hash_fun(key, &lim, h->seed);
-  val chain = vecref(h->table, num_fast(hv % h->modulus));
-  return h->hops->assoc_fun(key, hv, chain);
+  if (h->old_table)
+    hash_migrate(h, hash, h->old_size - h->migrate);
 }
 
-val gethash(val hash, val key)
+/*
+ * The slot of table which holds entry, located by identity along the
+ * probe sequence of its hash code, or -1.
+ */
+static cnum hash_entry_slot(val table, cnum size, u32_t *index, val entry)
 {
-  val self = lit("gethash");
-  val found = gethash_e(self, hash, key);
-  return if2(found, us_cdr(found));
-}
+  val *vec = table->v.vec;
 
-val inhash(val hash, val key, val init)
-{
-  val self = lit("inhash");
+  if (index) {
+    ucnum mask = 2 * size - 1;
+    ucnum i = entry->ch.hash & mask;
+    u32_t ix;
 
-  if (missingp(init)) {
-    return gethash_e(self, hash, key);
+    for (; (ix = index[i]) != 0; i = (i + 1) & mask)
+      if (vec[2 * (ix - 1) + 1] == entry)
+        return ix - 1;
   } else {
-    val new_p;
-    val cell = gethash_c(self, hash, key, mkcloc(new_p));
-    if (new_p)
-      us_rplacd(cell, init);
-    return cell;
+    ucnum mask = size - 1;
+    ucnum i = entry->ch.hash & mask;
+
+    for (; vec[2 * i + 1] != nil; i = (i + 1) & mask)
+      if (vec[2 * i + 1] == entry)
+        return i;
   }
+
+  return -1;
 }
 
-val gethash_n(val hash, val key, val notfound_val)
+/*
+ * Called before the current table of h is replaced. If there are
+ * iterators, some of them may be walking it, so it is kept for
+ * hash_delete_iter_tables.
+ */
+static void hash_supersede(struct hash *h, val hash)
 {
-  val self = lit("gethash-n");
-  val existing = gethash_e(self, hash, key);
-  return if3(existing, us_cdr(existing), default_null_arg(notfound_val));
+  if (h->usecount == 0)
+    h->iter_tables = nil;
+  else
+    mpush(h->table, mkloc(h->iter_tables, hash));
 }
 
-val sethash(val hash, val key, val value)
+/*
+ * Delete entry from the replaced tables which iterators may be walking.
+ */
+static void hash_delete_iter_tables(struct hash *h, val entry)
 {
-  val self = lit("sethash");
-  us_rplacd(gethash_c(self, hash, key, nulloc), value);
-  return value;
+  val iter;
+
+  for (iter = h->iter_tables; iter; iter = us_cdr(iter)) {
+    val table = us_car(iter);
+    val *vec = table->v.vec;
+    cnum size = c_n(vec[vec_length]) / 2, i;
+
+    if (h->index) {
+      for (i = 0; i < size && vec[2 * i + 1] != nil; i++) {
+        if (vec[2 * i + 1] == entry) {
+          vec[2 * i] = nil;
+          vec[2 * i + 1] = t;
+          break;
+        }
+      }
+    } else if ((i = hash_entry_slot(table, size, 0, entry)) >= 0) {
+      (void) table_delete(table, size, i);
+    }
+  }
 }
 
-val pushhash(val hash, val key, val value)
+/*
+ * Rebuild an ordered table at the given size, closing up its holes.
+ */
+static void hash_rebuild_ordered(struct hash *h, val hash, cnum new_size)
 {
-  val self = lit("pushhash");
-  val new_p;
+  val old_table = h->table;
+  cnum old_used = h->used, i;
+  val new_table = vector(num_fast(2 * new_size), nil);
+  val *old = old_table->v.vec;
+  u32_t *index = coerce(u32_t *, chk_calloc(2 * new_size, sizeof *index));
+
+  hash_supersede(h, hash);
+  free(h->index);
+  h->index = index;
+  h->table = new_table;
+  h->size = new_size;
+  h->used = 0;
+  setcheck(hash, new_table);
+
+  for (i = 0; i < old_used; i++) {
+    val entry = old[2 * i + 1];
+    if (hash_live_p(entry))
+      table_store(h, entry, old[2 * i]);
+  }
+}
+
+/*
+ * Start rebuilding the table without its deleted slots, doubling its size
+ * if it is more than half full of live entries. Any rebuild which is still
+ * in progress is completed first.
+ */
+static void hash_grow(struct hash *h, val hash)
+{
+  cnum size, new_size;
+  val new_table;
+
+  hash_migrate_all(h, hash);
+
+  size = h->size;
+  new_size = if3(2 * h->count >= size && 4 * size <= NUM_MAX, 2 * size, size);
+
+  if (h->index) {
+    hash_rebuild_ordered(h, hash, new_size);
+    return;
+  }
+
+  new_table = vector(num_fast(2 * new_size), nil);
+
+  hash_supersede(h, hash);
+  h->old_table = h->table;
+  h->old_size = size;
+  h->migrate = 0;
+  h->table = new_table;
+  h->size = new_size;
+  h->used = 0;
+  setcheck(hash, new_table);
+  setcheck(hash, h->old_table);
+}
+
+static val hash_find(struct hash *h, val key, cnum hv)
+{
+  cnum i = if3(h->index,
+               ordered_lookup(h, key, hv),
+               table_lookup(h->table, h->size, h->hops->equal_fun, key, hv));
+
+  if (i >= 0)
+    return h->table->v.vec[2 * i + 1];
+
+  if (h->old_table) {
+    i = table_lookup(h->old_table, h->old_size, h->hops->equal_fun, key, hv);
+    if (i >= 0)
+      return h->old_table->v.vec[2 * i + 1];
+  }
+
+  return nil;
+}
+
+/*
+ * Whether storing more entries requires the table to be rebuilt first.
+ */
+INLINE int hash_full_p(struct hash *h, cnum more)
+{
+  if (h->index)
+    return h->used + more > h->size;
+  return 4 * (h->used + more) > 3 * h->size;
+}
+
+/*
+ * The smallest table size which holds count entries without growing.
+ */
+static cnum hash_size_for(struct hash *h, cnum count)
+{
+  cnum size = HASH_MIN_SIZE;
+
+  while ((h->index ? size < count : 3 * size < 4 * count) &&
+         4 * size <= NUM_MAX)
+    size *= 2;
+
+  return size;
+}
+
+/*
+ * Rebuild the table at the given size, all at once. The size must be
+ * large enough for the entries.
+ */
+static void hash_resize(struct hash *h, val hash, cnum new_size)
+{
+  val new_table;
+
+  if (h->index) {
+    hash_rebuild_ordered(h, hash, new_size);
+    return;
+  }
+
+  hash_migrate_all(h, hash);
+  new_table = vector(num_fast(2 * new_size), nil);
+
+  hash_supersede(h, hash);
+  h->old_table = h->table;
+  h->old_size = h->size;
+  h->migrate = 0;
+  h->table = new_table;
+  h->size = new_size;
+  h->used = 0;
+  setcheck(hash, new_table);
+  setcheck(hash, h->old_table);
+
+  hash_migrate_all(h, hash);
+}
+
+/*
+ * Ensure that more additional entries can be stored without
+ * the table being rebuilt.
+ */
+static void hash_reserve_c(struct hash *h, val hash, cnum more)
+{
+  if (hash_full_p(h, more)) {
+    cnum size = hash_size_for(h, h->count + more);
+    hash_resize(h, hash, if3(size > h->size, size, h->size));
+  }
+}
+
+static void hash_insert(struct hash *h, val hash, val entry, cnum hv)
+{
+  if (hash_full_p(h, 1) &&
+      (h->usecount == 0 || 16 * (h->used + 1) > 15 * h->size))
+    hash_grow(h, hash);
+
+  table_store(h, entry, hash_code(hv));
+  h->count++;
+}
+
+static_def(struct hash_ops hash_eql_ops = hash_ops_init(eql_hash_op, eql,
+                                                        hash_assql));
+
+static_def(struct hash_ops hash_equal_ops = hash_ops_init(equal_hash, equal,
+                                                          hash_assoc));
+
+val make_seeded_hash(val weak_keys, val weak_vals, val equal_based, val seed)
+{
+  if (weak_keys && equal_based) {
+    uw_throwf(error_s,
+              lit("make-hash: bad combination :weak-keys with :equal-based"),
+              nao);
+  } else {
+    int flags = ((weak_vals != nil) << 1) | (weak_keys != nil);
+    struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
+    val table = vector(num_fast(2 * HASH_INIT_SIZE), nil);
+    val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
+
+    h->seed = convert(u32_t, c_unum(default_arg(seed,
+                                                if3(hash_seed_s,
+                                                    hash_seed, zero))));
+    h->flags = convert(hash_flags_t, flags);
+    h->size = HASH_INIT_SIZE;
+    h->count = 0;
+    h->used = 0;
+    h->old_table = nil;
+    h->old_size = h->migrate = 0;
+    h->iter_tables = nil;
+    h->table = table;
+    h->userdata = nil;
+
+    h->usecount = 0;
+    h->hops = equal_based ? &hash_equal_ops : &hash_eql_ops;
+    h->index = 0;
+
+    return hash;
+  }
+}
+
+/*
+ * Make an empty table ordered.
+ */
+static void hash_order(struct hash *h)
+{
+  h->index = coerce(u32_t *, chk_calloc(2 * h->size, sizeof *h->index));
+}
+
+val make_hash(val weak_keys, val weak_vals, val equal_based)
+{
+  return make_seeded_hash(weak_keys, weak_vals, equal_based, nil);
+}
+
+val make_similar_hash(val existing)
+{
+  val self = lit("make-similar-hash");
+  struct hash *ex = coerce(struct hash *, cobj_handle(self, existing, hash_s));
+  struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
+  val table = vector(num_fast(2 * HASH_INIT_SIZE), nil);
+  val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
+
+  h->size = HASH_INIT_SIZE;
+  h->count = 0;
+  h->used = 0;
+  h->old_table = nil;
+  h->old_size = h->migrate = 0;
+  h->iter_tables = nil;
+  h->table = table;
+  h->userdata = ex->userdata;
+
+  h->seed = ex->seed;
+  h->flags = ex->flags;
+  h->usecount = 0;
+  h->hops = ex->hops;
+  h->index = 0;
+
+  if (ex->index)
+    hash_order(h);
+
+  return hash;
+}
+
+/*
+ * Insert copies of the live entries in the given slots of table into h.
+ */
+static void hash_copy_slots(struct hash *h, val hash, val table,
+                            cnum from, cnum to)
+{
+  cnum i;
+
+  for (i = from; i < to; i++) {
+    val entry = table->v.vec[2 * i + 1];
+
+    if (hash_live_p(entry)) {
+      val nentry = make_hash_entry(us_car(entry), us_cdr(entry),
+                                   entry->ch.hash);
+      hash_insert(h, hash, nentry, nentry->ch.hash);
+    }
+  }
+}
+
+val copy_hash(val existing)
+{
+  val self = lit("copy-hash");
+  struct hash *ex = coerce(struct hash *, cobj_handle(self, existing, hash_s));
+  struct hash *h = coerce(struct hash *, chk_malloc(sizeof *h));
+  val table = vector(num_fast(2 * ex->size), nil);
+  val hash = cobj(coerce(mem_t *, h), hash_s, &hash_ops);
+
+  h->size = ex->size;
+  h->count = 0;
+  h->used = 0;
+  h->old_table = nil;
+  h->old_size = h->migrate = 0;
+  h->iter_tables = nil;
+  h->table = table;
+  h->userdata = ex->userdata;
+
+  h->seed = ex->seed;
+  h->flags = ex->flags;
+  h->usecount = 0;
+  h->hops = ex->hops;
+  h->index = 0;
+
+  if (ex->index)
+    hash_order(h);
+
+  /* A rebuild in progress in the existing table is not completed; the
+     entries which are yet to be migrated are copied from its old table. */
+  hash_copy_slots(h, hash, ex->table, 0, ex->size);
+
+  if (ex->old_table)
+    hash_copy_slots(h, hash, ex->old_table, ex->migrate, ex->old_size);
+
+  return hash;
+}
+
+val gethash_c(val self, val hash, val key, loc new_p)
+{
+  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  int lim = hash_rec_limit;
+  cnum hv = h->hops->hash_fun(key, &lim, h->seed);
+  val entry = (hash_migrate(h, hash, HASH_MIGRATE_STEP),
+               hash_find(h, key, hv));
+
+  if (entry) {
+    if (!nullocp(new_p))
+      deref(new_p) = nil;
+    return entry;
+  }
+
+  entry = make_hash_entry(key, nil, hv);
+  hash_insert(h, hash, entry, hv);
+
+  if (!nullocp(new_p))
+    deref(new_p) = t;
+
+  return entry;
+}
+
+val gethash_e(val self, val hash, val key)
+{
+  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  int lim = hash_rec_limit;
+  cnum hv = h->hops->hash_fun(key, &lim, h->seed);
+  hash_migrate(h, hash, HASH_MIGRATE_STEP);
+  return hash_find(h, key, hv);
+}
+
+val gethash(val hash, val key)
+{
+  val self = lit("gethash");
+  val found;
+
+  if (cdbp(hash))
+    return cdb_get(hash, key, nil);
+
+  found = gethash_e(self, hash, key);
+  return if2(found, us_cdr(found));
+}
+
+val inhash(val hash, val key, val init)
+{
+  val self = lit("inhash");
+
+  if (missingp(init)) {
+    return gethash_e(self, hash, key);
+  } else {
+    val new_p;
+    val cell = gethash_c(self, hash, key, mkcloc(new_p));
+    if (new_p)
+      us_rplacd(cell, init);
+    return cell;
+  }
+}
+
+val gethash_n(val hash, val key, val notfound_val)
+{
+  val self = lit("gethash-n");
+  val existing;
+
+  if (cdbp(hash))
+    return cdb_get(hash, key, notfound_val);
+
+  existing = gethash_e(self, hash, key);
+  return if3(existing, us_cdr(existing), default_null_arg(notfound_val));
+}
+
+val sethash(val hash, val key, val value)
+{
+  val self = lit("sethash");
+  us_rplacd(gethash_c(self, hash, key, nulloc), value);
+  return value;
+}
+
+val pushhash(val hash, val key, val value)
+{
+  val self = lit("pushhash");
+  val new_p;
   mpush(value, gethash_l(self, hash, key, mkcloc(new_p)));
   return new_p;
 }
@@ -848,16 +1428,32 @@ val remhash(val hash, val key)
   struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
   int lim = hash_rec_limit;
   cnum hv = h->hops->hash_fun(key, &lim, h->seed);
-  val *pchain = valptr(vecref_l(h->table, num_fast(hv % h->modulus)));
-  val existing = h->hops->assoc_fun(key, hv, *pchain);
+  val existing = nil;
+  cnum i;
 
-  if (existing) {
-    for (; *pchain; pchain = us_cdr_p(*pchain)) {
-      if (us_car(*pchain) == existing) {
-        *pchain = us_cdr(*pchain);
-        break;
-      }
+  hash_migrate(h, hash, HASH_MIGRATE_STEP);
+
+  i = if3(h->index,
+          ordered_lookup(h, key, hv),
+          table_lookup(h->table, h->size, h->hops->equal_fun, key, hv));
+
+  if (i >= 0) {
+    existing = h->table->v.vec[2 * i + 1];
+    hash_delete_slot(h, i);
+  }
+
+  if (h->old_table) {
+    i = table_lookup(h->old_table, h->old_size, h->hops->equal_fun, key, hv);
+
+    if (i >= 0) {
+      existing = h->old_table->v.vec[2 * i + 1];
+      (void) table_delete(h->old_table, h->old_size, i);
     }
+  }
+
+  if (existing) {
+    if (h->iter_tables)
+      hash_delete_iter_tables(h, existing);
     h->count--;
     bug_unless (h->count >= 0);
     return us_cdr(existing);
@@ -870,30 +1466,87 @@ val clearhash(val hash)
 {
   val self = lit("clearhash");
   struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
-  val mod = num_fast(256);
-  val table = vector(mod, nil);
   cnum oldcount = h->count;
-  h->modulus = c_num(mod);
+
+  if (h->usecount > 0) {
+    /* Clear in place, so that iterators see no more entries. */
+    val *vec = h->table->v.vec;
+    cnum i;
+    for (i = 0; i < 2 * h->size; i++)
+      vec[i] = nil;
+    if (h->old_table) {
+      vec = h->old_table->v.vec;
+      for (i = 0; i < 2 * h->old_size; i++)
+        vec[i] = nil;
+    }
+    for (; h->iter_tables; h->iter_tables = us_cdr(h->iter_tables)) {
+      val table = us_car(h->iter_tables);
+      cnum len = c_n(table->v.vec[vec_length]);
+      for (i = 0; i < len; i++)
+        table->v.vec[i] = nil;
+    }
+    if (h->index)
+      memset(h->index, 0, 2 * h->size * sizeof *h->index);
+  } else {
+    val table = vector(num_fast(2 * HASH_INIT_SIZE), nil);
+    h->size = HASH_INIT_SIZE;
+    h->table = table;
+    setcheck(hash, table);
+    if (h->index) {
+      free(h->index);
+      h->index = 0;
+      hash_order(h);
+    }
+  }
+
   h->count = 0;
-  h->table = table;
-  setcheck(hash, table);
+  h->used = 0;
+  h->old_table = nil;
+  h->old_size = h->migrate = 0;
   return oldcount ? num(oldcount) : nil;
 }
 
-val hash_count(val hash)
+val hash_reserve(val hash, val count)
 {
-  val self = lit("hash-count");
+  val self = lit("hash-reserve");
   struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
-  return num_fast(h->count);
-}
+  cnum c = c_num(count);
 
-val us_hash_count(val hash)
-{
-  struct hash *h = coerce(struct hash *, hash->co.handle);
-  return num_fast(h->count);
+  if (c < 0)
+    uw_throwf(error_s, lit("~a: count ~s is negative"), self, count, nao);
+
+  if (c > h->count)
+    hash_reserve_c(h, hash, c - h->count);
+
+  return hash;
 }
 
-val get_hash_userdata(val hash)
+val hash_shrink(val hash)
+{
+  val self = lit("hash-shrink");
+  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  cnum size = hash_size_for(h, h->count);
+
+  if (size < h->size || h->used > h->count || h->old_table)
+    hash_resize(h, hash, if3(size < h->size, size, h->size));
+
+  return hash;
+}
+
+val hash_count(val hash)
+{
+  val self = lit("hash-count");
+  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  return num_fast(h->count);
+}
+
+val us_hash_count(val hash)
+{
+  struct hash *h = coerce(struct hash *, hash->co.handle);
+  return num_fast(h->count);
+}
+
+val get_hash_userdata(val hash)
 {
   val self = lit("get-hash-userdata");
   struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
@@ -919,7 +1572,8 @@ static void hash_iter_mark(val hash_iter)
   struct hash_iter *hi = coerce(struct hash_iter *, hash_iter->co.handle);
   if (hi->hash)
     gc_mark(hi->hash);
-  gc_mark(hi->cons);
+  gc_mark(hi->table);
+  gc_mark(hi->old_table);
   hi->next = reachable_iters;
   reachable_iters = hi;
 }
@@ -930,647 +1584,1629 @@ static struct cobj_ops hash_iter_ops = cobj_ops_init(eq,
                                                      hash_iter_mark,
                                                      cobj_eq_hash_op);
 
-val hash_begin(val hash)
+val hash_begin(val hash)
+{
+  val self = lit("hash-begin");
+  val hi_obj;
+  struct hash *h;
+  struct hash_iter *hi;
+
+  if (hamtp(hash))
+    return hamt_begin(hash);
+
+  if (cdbp(hash))
+    return cdb_begin(hash);
+
+  h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  hi = coerce(struct hash_iter *, chk_malloc(sizeof *hi));
+
+  hi->next = 0;
+  hi->hash = nil;
+  hi->table = nil;
+  hi->index = -1;
+  hi->old_table = nil;
+  hi->old_index = hi->migrate = 0;
+  hi_obj = cobj(coerce(mem_t *, hi), hash_iter_s, &hash_iter_ops);
+  hi->hash = hash;
+  hi->table = h->table;
+  if (h->old_table) {
+    hi->old_table = h->old_table;
+    hi->old_index = h->migrate - 1;
+    hi->migrate = h->migrate;
+  }
+  h->usecount++;
+  return hi_obj;
+}
+
+val hash_next(val iter)
+{
+  val self = lit("hash-next");
+  struct hash_iter *hi = coerce(struct hash_iter *,
+                                cobj_handle(self, iter, hash_iter_s));
+  val hash;
+  struct hash *h;
+  val *vec;
+  cnum size, old_size = 0;
+
+  if (iter->co.ops == &hamt_iter_ops)
+    return hamt_next(iter);
+
+  if (cdb_iter_p(iter))
+    return cdb_next(iter);
+
+  hash = hi->hash;
+  h = hash ? coerce(struct hash *, hash->co.handle) : 0;
+
+  if (!h)
+    return nil;
+
+  if (hi->old_table) {
+    val *old = hi->old_table->v.vec;
+    old_size = c_n(old[vec_length]) / 2;
+
+    while (hi->old_index + 1 < old_size) {
+      val entry = old[2 * ++hi->old_index + 1];
+      if (hash_live_p(entry))
+        return entry;
+    }
+  }
+
+  vec = hi->table->v.vec;
+  size = c_n(vec[vec_length]) / 2;
+
+  while (++hi->index < size) {
+    val entry = vec[2 * hi->index + 1];
+    if (hash_live_p(entry)) {
+      if (hi->old_table &&
+          hash_entry_slot(hi->old_table, old_size, 0, entry) >= hi->migrate)
+        continue;
+      return entry;
+    }
+    if (entry == nil && h->index)
+      break;
+  }
+
+  hi->hash = nil;
+  hi->table = nil;
+  hi->old_table = nil;
+  if (--h->usecount == 0)
+    h->iter_tables = nil;
+  return nil;
+}
+
+val maphash(val fun, val hash)
+{
+  val iter = hash_begin(hash);
+  val cell;
+  while ((cell = hash_next(iter)) != nil)
+    funcall2(fun, us_car(cell), us_cdr(cell));
+  return nil;
+}
+
+val hash_eql(val obj)
+{
+  int lim = 0;
+  return num_fast(eql_hash(obj, &lim));
+}
+
+val hash_equal(val obj, val seed)
+{
+  int lim = hash_rec_limit;
+  return num_fast(equal_hash(obj, &lim, if3(missingp(seed), 0, c_unum(seed))));
+}
+
+/*
+ * Called from garbage collector. Hash module must process all weak tables
+ * that were visited during the marking phase, maintained in the list
+ * reachable_weak_hashes.
+ */
+static int weak_entry_garbage_p(struct hash *h, val entry)
+{
+  if (!hash_live_p(entry) || gc_is_reachable(entry))
+    return 0;
+
+  switch (h->flags) {
+  case hash_weak_none:
+    /* what is this doing here */
+    return 0;
+  case hash_weak_keys:
+    return !gc_is_reachable(us_car(entry));
+  case hash_weak_vals:
+    return !gc_is_reachable(us_cdr(entry));
+  case hash_weak_both:
+    return !gc_is_reachable(us_car(entry)) || !gc_is_reachable(us_cdr(entry));
+  }
+
+  return 0;
+}
+
+static void hash_delete_entry(struct hash *h, val entry)
+{
+  cnum i = hash_entry_slot(h->table, h->size, h->index, entry);
+  int found = 0;
+
+#if CONFIG_EXTRA_DEBUGGING
+  if (us_car(entry) == break_obj || us_cdr(entry) == break_obj)
+    breakpt();
+#endif
+
+  if (i >= 0) {
+    hash_delete_slot(h, i);
+    found = 1;
+  }
+
+  /* Entries in the migrated part of the old table are also in the new
+     table, and were counted there. */
+  if (h->old_table) {
+    i = hash_entry_slot(h->old_table, h->old_size, 0, entry);
+    if (i >= 0) {
+      (void) table_delete(h->old_table, h->old_size, i);
+      if (i >= h->migrate)
+        found = 1;
+    }
+  }
+
+  if (h->iter_tables)
+    hash_delete_iter_tables(h, entry);
+
+  if (found)
+    h->count--;
+}
+
+/*
+ * Mark the values of the pending weak-key entries whose keys have become
+ * reachable, until no more keys become reachable that way.
+ * Each round examines only the entries which remain pending.
+ */
+static void do_ephemerons(void)
+{
+  int changed;
+
+  do {
+    cnum i, j;
+
+    changed = 0;
+
+    /* Marking may pend more entries; the count is reread every time. */
+    for (i = j = 0; i < weak_pending_count; i++) {
+      struct weak_pending wp = weak_pending[i];
+
+      if (wp.h->flags == hash_weak_keys && gc_is_reachable(us_car(wp.entry))) {
+        gc_mark(us_cdr(wp.entry));
+        changed = 1;
+      } else {
+        weak_pending[j++] = wp;
+      }
+    }
+
+    weak_pending_count = j;
+  } while (changed);
+}
+
+static void do_weak_tables(void)
+{
+  struct hash *h;
+  cnum i;
+
+  if (weak_pending_lost) {
+    for (h = reachable_weak_hashes; h != 0; h = h->next) {
+      val *vec = h->table->v.vec;
+
+      /* The table of a weak hash was spuriously reached by conservative
+         GC; all keys and values have been transitively marked as
+         reachable, and so we won't find anything to remove. */
+      if (gc_is_reachable(h->table))
+        continue;
+
+      for (i = 0; i < h->size; i++) {
+        val entry = vec[2 * i + 1];
+        if (weak_entry_garbage_p(h, entry))
+          hash_delete_entry(h, entry);
+      }
+
+      if (h->old_table) {
+        val *old = h->old_table->v.vec;
+
+        for (i = h->migrate; i < h->old_size; i++) {
+          val entry = old[2 * i + 1];
+          if (weak_entry_garbage_p(h, entry))
+            hash_delete_entry(h, entry);
+        }
+      }
+    }
+  } else {
+    for (i = 0; i < weak_pending_count; i++) {
+      struct weak_pending *wp = &weak_pending[i];
+
+      if (gc_is_reachable(wp->h->table))
+        continue;
+
+      if (weak_entry_garbage_p(wp->h, wp->entry))
+        hash_delete_entry(wp->h, wp->entry);
+    }
+  }
+
+  /* Garbage is gone now. Seal things by marking the vectors. */
+  for (h = reachable_weak_hashes; h != 0; h = h->next) {
+    bug_unless (h->count >= 0);
+    gc_mark(h->table);
+    gc_mark(h->old_table);
+    gc_mark(h->iter_tables);
+  }
+
+  /* Done with weak processing; clear out the lists in preparation for
+     the next gc round. */
+  reachable_weak_hashes = 0;
+  weak_pending_count = 0;
+  weak_pending_lost = 0;
+}
+
+static struct hash *iter_counted_hash(struct hash_iter *hi)
+{
+  val hash = hi->hash;
+
+  if (!hash)
+    return 0;
+
+#if CONFIG_GEN_GC
+  /* If the hash is a tenured object, we do not touch it.
+     It wasn't marked and so it isn't being recounted. */
+  if (!full_gc && hash->t.gen > 0)
+    return 0;
+#endif
+
+  return coerce(struct hash *, hash->co.handle);
+}
+
+static void do_iters(void)
+{
+  struct hash *h;
+  struct hash_iter *hi;
+
+  /* The tables which were in use when they were marked are counted
+     from zero, and so are those of the reachable iterators: during an
+     incremental cycle, a table may gain an iterator after being marked. */
+  for (h = reachable_used_hashes; h != 0; h = h->used_next)
+    h->usecount = 0;
+
+  for (hi = reachable_iters; hi != 0; hi = hi->next)
+    if ((h = iter_counted_hash(hi)) != 0)
+      h->usecount = 0;
+
+  for (hi = reachable_iters; hi != 0; hi = hi->next)
+    if ((h = iter_counted_hash(hi)) != 0)
+      h->usecount++;
+
+  reachable_used_hashes = 0;
+  reachable_iters = 0;
+}
+
+/*
+ * Called from the garbage collector at the end of an incremental marking
+ * cycle. The entries of weak tables are not marked, so values or keys that
+ * were stored into them while the cycle was under way were not seen by
+ * the write barrier. Every entry is scanned again, and the pending
+ * entries are recorded afresh.
+ */
+void hash_remark_weak(void)
+{
+  struct hash *h;
+  cnum i;
+
+  weak_pending_count = 0;
+  weak_pending_lost = 0;
+
+  for (h = reachable_weak_hashes; h != 0; h = h->next) {
+    for (i = 0; i < h->size; i++) {
+      val entry = h->table->v.vec[2 * i + 1];
+      if (hash_live_p(entry))
+        weak_entry_scan(h, entry);
+    }
+
+    for (i = h->migrate; i < h->old_size; i++) {
+      val entry = h->old_table->v.vec[2 * i + 1];
+      if (hash_live_p(entry))
+        weak_entry_scan(h, entry);
+    }
+  }
+}
+
+void hash_process_weak(void)
+{
+  do_ephemerons();
+  do_weak_tables();
+  do_iters();
+}
+
+static val equal_based_p(val equal, val eql, val wkeys)
+{
+  if (opt_compat && opt_compat <= 187)
+    return equal;
+
+  if (equal && eql)
+    uw_throwf(error_s,
+              lit("make-hash: mutually exclusive :equal-based and :eql-based"),
+              nao);
+
+  if (wkeys) {
+    if (equal)
+      uw_throwf(error_s,
+                lit("make-hash: mutually exclusive :equal-based and :weak-keys"),
+                nao);
+    else
+      eql = t;
+  }
+
+  return null(eql);
+}
+
+val hashv(struct args *args)
+{
+  val wkeys = nil, wvals = nil, equal = nil, eql = nil, userdata = nil;
+  val size = nil, ordered = nil;
+  struct args_bool_key akv[] = {
+    { weak_keys_k, nil, &wkeys },
+    { weak_vals_k, nil, &wvals },
+    { equal_based_k, nil, &equal },
+    { eql_based_k, nil, &eql },
+    { userdata_k, t, &userdata },
+    { size_k, t, &size },
+    { ordered_k, nil, &ordered }
+  };
+  val hash = (args_keys_extract(args, akv, sizeof akv / sizeof akv[0]),
+              make_hash(wkeys, wvals, equal_based_p(equal, eql, wkeys)));
+  if (ordered)
+    hash_order(coerce(struct hash *, hash->co.handle));
+  if (userdata)
+    set_hash_userdata(hash, userdata);
+  if (size)
+    hash_reserve(hash, size);
+  return hash;
+}
+
+val hashl(val arglist)
+{
+  args_decl_list(args, ARGS_MIN, arglist);
+  return hashv(args);
+}
+
+/*
+ * Bulk loading: the table is sized once for the number of items, which
+ * are then stored without checking whether the table must grow.
+ */
+static struct hash *hash_load_start(val hash, val seq)
+{
+  struct hash *h = coerce(struct hash *, hash->co.handle);
+  hash_reserve_c(h, hash, c_num(length(seq)));
+  return h;
+}
+
+static void hash_load(struct hash *h, val hash, val key, val value)
+{
+  int lim = hash_rec_limit;
+  cnum hv = h->hops->hash_fun(key, &lim, h->seed);
+  val entry = hash_find(h, key, hv);
+
+  if (!entry) {
+    entry = make_hash_entry(key, nil, hv);
+    table_store(h, entry, hash_code(hv));
+    h->count++;
+  }
+
+  us_rplacd(entry, value);
+}
+
+val hash_construct(val hashl_args, val pairs)
+{
+  val hash = hashl(hashl_args);
+  struct hash *h = hash_load_start(hash, pairs = nullify(pairs));
+
+  for (; pairs; pairs = cdr(pairs)) {
+    val pair = car(pairs);
+    hash_load(h, hash, first(pair), second(pair));
+  }
+
+  return hash;
+}
+
+val hash_from_pairs_v(val pairs, struct args *hashv_args)
+{
+  return hash_construct(args_get_list(hashv_args), pairs);
+}
+
+val hash_from_alist_v(val alist, struct args *hashv_args)
+{
+  val hash = hashv(hashv_args);
+  struct hash *h = hash_load_start(hash, alist = nullify(alist));
+
+  for (; alist; alist = cdr(alist)) {
+    val pair = car(alist);
+    hash_load(h, hash, car(pair), cdr(pair));
+  }
+
+  return hash;
+}
+
+val hash_list(val keys, struct args *hashv_args)
+{
+  val hash = hashv(hashv_args);
+  struct hash *h = hash_load_start(hash, keys = nullify(keys));
+
+  for (; keys; keys = cdr(keys)) {
+    val key = car(keys);
+    hash_load(h, hash, key, key);
+  }
+
+  return hash;
+}
+
+val group_by(val func, val seq, struct args *hashv_args)
+{
+  val self = lit("group-by");
+  val hash = hashv(hashv_args);
+
+  if (vectorp(seq)) {
+    cnum i, len;
+
+    for (i = 0, len = c_fixnum(length(seq), self); i < len; i++) {
+      val v = vecref(seq, num_fast(i));
+      pushhash(hash, funcall1(func, v), v);
+    }
+  } else {
+    for (; seq; seq = cdr(seq)) {
+      val v = car(seq);
+      pushhash(hash, funcall1(func, v), v);
+    }
+  }
+
+  {
+    val iter = hash_begin(hash);
+    val cell;
+
+    while ((cell = hash_next(iter)) != nil)
+      us_rplacd(cell, nreverse(us_cdr(cell)));
+
+    return hash;
+  }
+}
+
+val group_reduce(val hash, val by_fun, val reduce_fun, val seq,
+                 val initval, val filter_fun)
+{
+  val self = lit("group-reduce");
+  initval = default_null_arg(initval);
+
+  if (vectorp(seq)) {
+    cnum i, len;
+
+    for (i = 0, len = c_fixnum(length(seq), self); i < len; i++) {
+      val v = vecref(seq, num_fast(i));
+      val key = funcall1(by_fun, v);
+      val new_p;
+      loc pcdr = gethash_l(self, hash, key, mkcloc(new_p));
+
+      if (new_p)
+        set(pcdr, funcall2(reduce_fun, initval, v));
+      else
+        set(pcdr, funcall2(reduce_fun, deref(pcdr), v));
+    }
+  } else {
+    for (; seq; seq = cdr(seq)) {
+      val v = car(seq);
+      val key = funcall1(by_fun, v);
+      val new_p;
+      loc pcdr = gethash_l(self, hash, key, mkcloc(new_p));
+
+      if (new_p)
+        set(pcdr, funcall2(reduce_fun, initval, v));
+      else
+        set(pcdr, funcall2(reduce_fun, deref(pcdr), v));
+    }
+  }
+
+  if (!null_or_missing_p(filter_fun)) {
+    val iter = hash_begin(hash);
+    val cell;
+
+    while ((cell = hash_next(iter)) != nil)
+      us_rplacd(cell, funcall1(filter_fun, us_cdr(cell)));
+  }
+
+  return hash;
+}
+
+static val hash_keys_lazy(val iter, val lcons)
+{
+  val cell = hash_next(iter);
+  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), us_car(cell))));
+  return nil;
+}
+
+val hash_keys(val hash)
+{
+  val iter = hash_begin(hash);
+  val cell = hash_next(iter);
+  if (!cell)
+    return nil;
+  return make_lazy_cons_car(func_f1(iter, hash_keys_lazy), us_car(cell));
+}
+
+static val hash_values_lazy(val iter, val lcons)
+{
+  val cell = hash_next(iter);
+  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), us_cdr(cell))));
+  return nil;
+}
+
+val hash_values(val hash)
+{
+  val iter = hash_begin(hash);
+  val cell = hash_next(iter);
+  if (!cell)
+    return nil;
+  return make_lazy_cons_car(func_f1(iter, hash_values_lazy), us_cdr(cell));
+}
+
+static val hash_pairs_lazy(val iter, val lcons)
+{
+  val cell = hash_next(iter);
+  us_rplacd(lcons, if2(cell,
+                       make_lazy_cons_car(us_lcons_fun(lcons),
+                                          cons(us_car(cell),
+                                               cons(us_cdr(cell),
+                                                    nil)))));
+  return nil;
+}
+
+val hash_pairs(val hash)
+{
+  val iter = hash_begin(hash);
+  val cell = hash_next(iter);
+  if (!cell)
+    return nil;
+  return make_lazy_cons_car(func_f1(iter, hash_pairs_lazy),
+                            cons(us_car(cell), cons(us_cdr(cell), nil)));
+}
+
+static val hash_alist_lazy(val iter, val lcons)
+{
+  val cell = hash_next(iter);
+  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), cell)));
+  return nil;
+}
+
+val hash_alist(val hash)
+{
+  val iter = hash_begin(hash);
+  val cell = hash_next(iter);
+  if (!cell)
+    return nil;
+  return make_lazy_cons_car(func_f1(iter, hash_alist_lazy), cell);
+}
+
+val hash_uni(val hash1, val hash2, val join_func)
+{
+  val self = lit("hash-uni");
+  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
+  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+
+  if (h1->hops != h2->hops)
+    uw_throwf(error_s, lit("~a: ~s and ~s are incompatible hashes"),
+              self, hash1, hash2, nao);
+
+  {
+    val hout = make_similar_hash(hash1);
+    val hiter, entry;
+
+    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      sethash(hout, us_car(entry), us_cdr(entry));
+    }
+
+    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      if (missingp(join_func)) {
+        sethash(hout, us_car(entry), us_cdr(entry));
+      } else {
+        val new_p;
+        loc ptr = gethash_l(self, hout, us_car(entry), mkcloc(new_p));
+        if (new_p)
+          sethash(hout, us_car(entry), us_cdr(entry));
+        else
+          set(ptr, funcall2(join_func, us_cdr(entry), deref(ptr)));
+      }
+    }
+
+    return hout;
+  }
+}
+
+val hash_diff(val hash1, val hash2)
+{
+  val self = lit("hash-diff");
+  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
+  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+
+  if (h1->hops != h2->hops)
+    uw_throwf(error_s, lit("~a: ~s and ~a are incompatible hashes"),
+              self, hash1, hash2, nao);
+
+  {
+    val hout = copy_hash(hash1);
+    val hiter, entry;
+
+    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      remhash(hout, us_car(entry));
+    }
+
+    return hout;
+  }
+}
+
+val hash_symdiff(val hash1, val hash2)
+{
+  val self = lit("hash-symdiff");
+  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
+  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+
+  if (h1->hops != h2->hops)
+    uw_throwf(error_s, lit("~a: ~s and ~a are incompatible hashes"),
+              self, hash1, hash2, nao);
+
+  {
+    val hout = make_similar_hash(hash1);
+    val hiter, entry;
+
+    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      if (!gethash_e(self, hash2, us_car(entry)))
+        sethash(hout, us_car(entry), us_cdr(entry));
+    }
+
+    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      if (!gethash_e(self, hash1, us_car(entry)))
+        sethash(hout, us_car(entry), us_cdr(entry));
+    }
+
+    return hout;
+  }
+}
+
+val hash_isec(val hash1, val hash2, val join_func)
+{
+  val self = lit("hash-isec");
+  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
+  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+
+  if (h1->hops != h2->hops)
+    uw_throwf(error_s, lit("~a: ~s and ~s are incompatible hashes"),
+              self, hash1, hash2, nao);
+
+  {
+    val hout = make_similar_hash(hash1);
+    val hiter, entry;
+
+    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
+         entry;
+         entry = hash_next(hiter))
+    {
+      val found = gethash_e(self, hash2, us_car(entry));
+      if (found) {
+        if (missingp(join_func))
+          sethash(hout, us_car(entry), us_cdr(entry));
+        else
+          sethash(hout, us_car(entry), funcall2(join_func, us_cdr(entry), us_cdr(found)));
+      }
+    }
+
+    return hout;
+  }
+}
+
+val hash_subset(val hash1, val hash2)
+{
+  val hiter, entry;
+
+  for (hiter = hash_begin(hash1), entry = hash_next(hiter);
+       entry;
+       entry = hash_next(hiter))
+  {
+    if (!inhash(hash2, us_car(entry), colon_k))
+      return nil;
+  }
+
+  return t;
+}
+
+val hash_proper_subset(val hash1, val hash2)
+{
+  return and2(hash_subset(hash1, hash2),
+              null(numeq(hash_count(hash1), hash_count(hash2))));
+}
+
+val hash_update(val hash, val fun)
+{
+  val iter = hash_begin(hash);
+  val cell;
+  while ((cell = hash_next(iter)) != nil) {
+    loc ptr = mkloc(*us_cdr_p(cell), cell);
+    set(ptr, funcall1(fun, deref(ptr)));
+  }
+  return hash;
+}
+
+val hash_update_1(val hash, val key, val fun, val init)
+{
+  val self = lit("hash-update-1");
+
+  if (missingp(init)) {
+    val cons = gethash_e(self, hash, key);
+    if (cons) {
+      val data = us_cdr(cons);
+      us_rplacd(cons, funcall1(fun, data));
+      return data;
+    }
+    return nil;
+  } else {
+    val new_p;
+    loc place = gethash_l(self, hash, key, mkcloc(new_p));
+    if (new_p)
+      set(place, funcall1(fun, init));
+    else
+      set(place, funcall1(fun, deref(place)));
+    return deref(place);
+  }
+}
+
+val hash_revget(val hash, val value, val test, val keyfun)
+{
+  val iter = hash_begin(hash);
+  val cell;
+
+  test = default_arg(test, eql_f);
+  keyfun = default_arg(keyfun, identity_f);
+
+  while ((cell = hash_next(iter)) != nil) {
+    if (funcall2(test, value, funcall1(keyfun, us_cdr(cell))))
+      return us_car(cell);
+  }
+
+  return nil;
+}
+
+/*
+ * A hamt is a persistent map, represented as a hash array mapped trie.
+ * Each level of the trie is indexed by five bits of the 32 bit hash code
+ * of the key: a node has a bitmap of the occupied positions, and a
+ * compact array holding only those slots, in the order of the bits.
+ * A slot is either an entry cons, carrying its hash code like a hash
+ * table entry, or a node of the next level. After the hash code is
+ * exhausted, a node is an unordered collision list of entries whose hash
+ * codes are identical.
+ *
+ * Nodes and entries are never modified once they are reachable from a
+ * hamt. Adding or removing a key copies only the nodes on the path to
+ * the key, sharing everything else with the original map. A node left
+ * holding a single entry is replaced by that entry in its parent, so the
+ * trie has the same shape regardless of the history of updates.
+ */
+struct hamt {
+  val root;
+  cnum count;
+  ucnum seed;
+  struct hash_ops *hops;
+};
+
+struct hamt_node {
+  u32_t bitmap;
+  int nslots;
+  val slot[1];
+};
+
+#define HAMT_BITS 5
+#define HAMT_MASK ((1 << HAMT_BITS) - 1)
+#define HAMT_HASH_BITS 32
+#define HAMT_MAX_DEPTH (HAMT_HASH_BITS / HAMT_BITS + 2)
+
+struct hamt_iter {
+  val hamt;
+  int depth;
+  val node[HAMT_MAX_DEPTH];
+  int index[HAMT_MAX_DEPTH];
+};
+
+val hamt_s, hamt_node_s;
+
+static int hamt_popcount(u32_t x)
+{
+  x = x - ((x >> 1) & 0x55555555U);
+  x = (x & 0x33333333U) + ((x >> 2) & 0x33333333U);
+  x = (x + (x >> 4)) & 0x0f0f0f0fU;
+  return (x * 0x01010101U) >> 24;
+}
+
+static void hamt_node_mark(val obj)
+{
+  struct hamt_node *n = coerce(struct hamt_node *, obj->co.handle);
+  int i;
+
+  for (i = 0; i < n->nslots; i++)
+    gc_mark(n->slot[i]);
+}
+
+static struct cobj_ops hamt_node_ops = cobj_ops_init(eq,
+                                                     cobj_print_op,
+                                                     cobj_destroy_free_op,
+                                                     hamt_node_mark,
+                                                     cobj_eq_hash_op);
+
+/*
+ * A new node is the youngest object in anything that it points to, so it
+ * can be filled in without any write barrier.
+ */
+static val hamt_node(u32_t bitmap, int nslots)
 {
-  val self = lit("hash-begin");
-  val hi_obj;
-  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
-  struct hash_iter *hi = coerce(struct hash_iter *, chk_malloc(sizeof *hi));
+  size_t size = offsetof(struct hamt_node, slot) + nslots * sizeof (val);
+  struct hamt_node *n = coerce(struct hamt_node *, chk_calloc(1, size));
+  n->bitmap = bitmap;
+  n->nslots = nslots;
+  return cobj(coerce(mem_t *, n), hamt_node_s, &hamt_node_ops);
+}
 
-  hi->next = 0;
-  hi->hash = nil;
-  hi->chain = -1;
-  hi->cons = nil;
-  hi_obj = cobj(coerce(mem_t *, hi), hash_iter_s, &hash_iter_ops);
-  hi->hash = hash;
-  h->usecount++;
-  return hi_obj;
+INLINE struct hamt_node *hamt_n(val node)
+{
+  return coerce(struct hamt_node *, node->co.handle);
 }
 
-val hash_next(val iter)
+INLINE u32_t hamt_code(val entry)
 {
-  val self = lit("hash-next");
-  struct hash_iter *hi = coerce(struct hash_iter *,
-                                cobj_handle(self, iter, hash_iter_s));
-  val hash = hi->hash;
-  struct hash *h = hash ? coerce(struct hash *, hash->co.handle) : 0;
+  return convert(u32_t, entry->ch.hash);
+}
 
-  if (!h)
-    return nil;
-  if (hi->cons)
-    hi->cons = us_cdr(hi->cons);
-  while (nilp(hi->cons)) {
-    if (++hi->chain >= h->modulus) {
-      hi->hash = nil;
-      h->usecount--;
-      return nil;
-    }
-    set(mkloc(hi->cons, iter), vecref(h->table, num_fast(hi->chain)));
+static val hamt_copy_node(val node, int skip, int insert, val slot)
+{
+  struct hamt_node *n = hamt_n(node);
+  val copy = hamt_node(n->bitmap, n->nslots + (insert >= 0) - (skip >= 0));
+  struct hamt_node *c = hamt_n(copy);
+  int i, j;
+
+  for (i = j = 0; i <= n->nslots; i++) {
+    if (i == insert)
+      c->slot[j++] = slot;
+    if (i < n->nslots && i != skip)
+      c->slot[j++] = n->slot[i];
   }
-  return if2(hi->cons, us_car(hi->cons));
+
+  return copy;
 }
 
-val maphash(val fun, val hash)
+static val hamt_replace_slot(val node, int i, val slot)
 {
-  val iter = hash_begin(hash);
-  val cell;
-  while ((cell = hash_next(iter)) != nil)
-    funcall2(fun, us_car(cell), us_cdr(cell));
-  return nil;
+  val copy = hamt_copy_node(node, -1, -1, nil);
+  hamt_n(copy)->slot[i] = slot;
+  return copy;
 }
 
-val hash_eql(val obj)
+static val hamt_pair(int shift, val e1, val e2)
 {
-  int lim = 0;
-  return num_fast(eql_hash(obj, &lim));
+  u32_t h1 = hamt_code(e1), h2 = hamt_code(e2);
+  val node;
+
+  if (shift >= HAMT_HASH_BITS) {
+    node = hamt_node(0, 2);
+    hamt_n(node)->slot[0] = e1;
+    hamt_n(node)->slot[1] = e2;
+  } else {
+    int b1 = (h1 >> shift) & HAMT_MASK, b2 = (h2 >> shift) & HAMT_MASK;
+
+    if (b1 == b2) {
+      val sub = hamt_pair(shift + HAMT_BITS, e1, e2);
+      node = hamt_node(convert(u32_t, 1) << b1, 1);
+      hamt_n(node)->slot[0] = sub;
+    } else {
+      node = hamt_node((convert(u32_t, 1) << b1) | (convert(u32_t, 1) << b2), 2);
+      hamt_n(node)->slot[b1 > b2] = e1;
+      hamt_n(node)->slot[b1 < b2] = e2;
+    }
+  }
+
+  return node;
 }
 
-val hash_equal(val obj, val seed)
+static u32_t hamt_hash(struct hamt *m, val key)
 {
   int lim = hash_rec_limit;
-  return num_fast(equal_hash(obj, &lim, if3(missingp(seed), 0, c_unum(seed))));
+  return convert(u32_t, m->hops->hash_fun(key, &lim, m->seed));
 }
 
-/*
- * Called from garbage collector. Hash module must process all weak tables
- * that were visited during the marking phase, maintained in the list
- * reachable_weak_hashes.
- */
-static void do_weak_tables(void)
+static val hamt_lookup(struct hamt *m, val key, u32_t hv)
 {
-  struct hash *h;
-  cnum i;
+  val node = m->root;
+  int shift = 0;
 
-  for (h = reachable_weak_hashes; h != 0; h = h->next) {
-    /* The table of a weak hash was spuriously reached by conservative GC;
-       it's a waste of time doing weak processing, since all keys and
-       values have been transitively marked as reachable; and so we
-       won't find anything to remove. */
-    if (gc_is_reachable(h->table))
-      continue;
+  while (node) {
+    struct hamt_node *n = hamt_n(node);
+    val slot;
 
-    switch (h->flags) {
-    case hash_weak_none:
-      /* what is this doing here */
-      break;
-    case hash_weak_keys:
-      /* Sweep through all entries. Delete any which have keys
-         that are garbage. */
-      for (i = 0; i < h->modulus; i++) {
-        val ind = num_fast(i);
-        val *pchain = valptr(vecref_l(h->table, ind));
-        val *iter;
-
-        for (iter = pchain; !gc_is_reachable(*iter); ) {
-          val entry = us_car(*iter);
-          if (!gc_is_reachable(entry) && !gc_is_reachable(us_car(entry))) {
-            *iter = us_cdr(*iter);
-#if CONFIG_EXTRA_DEBUGGING
-            if (us_car(entry) == break_obj)
-              breakpt();
-#endif
-          } else {
-            iter = us_cdr_p(*iter);
-          }
-        }
-      }
-      /* Garbage is gone now. Seal things by marking the vector. */
-      gc_mark(h->table);
-      break;
-    case hash_weak_vals:
-      /* Sweep through all entries. Delete any which have values
-         that are garbage. */
-      for (i = 0; i < h->modulus; i++) {
-        val ind = num_fast(i);
-        val *pchain = valptr(vecref_l(h->table, ind));
-        val *iter;
-
-        for (iter = pchain; !gc_is_reachable(*iter); ) {
-          val entry = us_car(*iter);
-          if (!gc_is_reachable(entry) && !gc_is_reachable(us_cdr(entry))) {
-            *iter = us_cdr(*iter);
-#if CONFIG_EXTRA_DEBUGGING
-            if (us_cdr(entry) == break_obj)
-              breakpt();
-#endif
-          } else {
-            iter = us_cdr_p(*iter);
-          }
-        }
+    if (shift >= HAMT_HASH_BITS) {
+      int i;
+      for (i = 0; i < n->nslots; i++) {
+        val entry = n->slot[i];
+        if (m->hops->equal_fun(us_car(entry), key))
+          return entry;
       }
-      /* Garbage is gone now. Seal things by marking the vector. */
-      gc_mark(h->table);
-      break;
-    case hash_weak_both:
-      /* Sweep through all entries. Delete any which have keys
-         or values that are garbage. */
-      for (i = 0; i < h->modulus; i++) {
-        val ind = num_fast(i);
-        val *pchain = valptr(vecref_l(h->table, ind));
-        val *iter;
-
-        for (iter = pchain; !gc_is_reachable(*iter); ) {
-          val entry = us_car(*iter);
-          if (!gc_is_reachable(entry) &&
-              (!gc_is_reachable(us_car(entry)) || !gc_is_reachable(us_cdr(entry))))
-          {
-            *iter = us_cdr(*iter);
-#if CONFIG_EXTRA_DEBUGGING
-            if (!gc_is_reachable(us_car(entry)) && us_car(entry) == break_obj)
-              breakpt();
-            if (!gc_is_reachable(us_cdr(entry)) && us_cdr(entry) == break_obj)
-              breakpt();
-#endif
-          } else {
-            iter = us_cdr_p(*iter);
-          }
-        }
+      return nil;
+    } else {
+      u32_t bit = convert(u32_t, 1) << ((hv >> shift) & HAMT_MASK);
+
+      if ((n->bitmap & bit) == 0)
+        return nil;
+
+      slot = n->slot[hamt_popcount(n->bitmap & (bit - 1))];
+
+      if (consp(slot)) {
+        if (hamt_code(slot) == hv && m->hops->equal_fun(us_car(slot), key))
+          return slot;
+        return nil;
       }
-      /* Garbage is gone now. Seal things by marking the vector. */
-      gc_mark(h->table);
-      break;
+
+      node = slot;
+      shift += HAMT_BITS;
     }
   }
 
-  /* Done with weak processing; clear out the list in preparation for
-     the next gc round. */
-  reachable_weak_hashes = 0;
+  return nil;
 }
 
-static void do_iters(void)
+static val hamt_assoc_node(struct hamt *m, val node, int shift,
+                           val entry, int *added)
 {
-  struct hash_iter *hi;
+  struct hamt_node *n = hamt_n(node);
+  val key = us_car(entry);
+  u32_t hv = hamt_code(entry);
 
-  for (hi = reachable_iters; hi != 0; hi = hi->next) {
-    val hash = hi->hash;
+  if (shift >= HAMT_HASH_BITS) {
+    int i;
+    for (i = 0; i < n->nslots; i++)
+      if (m->hops->equal_fun(us_car(n->slot[i]), key))
+        return hamt_replace_slot(node, i, entry);
+    *added = 1;
+    return hamt_copy_node(node, -1, n->nslots, entry);
+  } else {
+    u32_t bit = convert(u32_t, 1) << ((hv >> shift) & HAMT_MASK);
+    int i = hamt_popcount(n->bitmap & (bit - 1));
+    val slot;
+
+    if ((n->bitmap & bit) == 0) {
+      val copy = hamt_copy_node(node, -1, i, entry);
+      hamt_n(copy)->bitmap |= bit;
+      *added = 1;
+      return copy;
+    }
 
-    if (!hash)
-      continue;
+    slot = n->slot[i];
 
-#if CONFIG_GEN_GC
-    /* If the hash is a tenured object, we do not touch it.
-       It wasn't marked and so its usecount wasn't reset to zero. */
-    if (!full_gc && hash->t.gen > 0)
-      continue;
-#endif
+    if (!consp(slot))
+      return hamt_replace_slot(node, i,
+                               hamt_assoc_node(m, slot, shift + HAMT_BITS,
+                                               entry, added));
 
-    {
-      struct hash *h = coerce(struct hash *, hash->co.handle);
-      h->usecount++;
-    }
-  }
+    if (hamt_code(slot) == hv && m->hops->equal_fun(us_car(slot), key))
+      return hamt_replace_slot(node, i, entry);
 
-  reachable_iters = 0;
+    *added = 1;
+    return hamt_replace_slot(node, i,
+                             hamt_pair(shift + HAMT_BITS, slot, entry));
+  }
 }
 
-void hash_process_weak(void)
+/*
+ * Returns the node itself if the key is not found, otherwise the
+ * replacement for the node: a new node, or the sole remaining entry of a
+ * node below the root, or nil if nothing remains.
+ */
+static val hamt_dissoc_node(struct hamt *m, val node, int shift,
+                            val key, u32_t hv)
 {
-  do_weak_tables();
-  do_iters();
-}
+  struct hamt_node *n = hamt_n(node);
+  val sub;
+  int i;
 
-static val equal_based_p(val equal, val eql, val wkeys)
-{
-  if (opt_compat && opt_compat <= 187)
-    return equal;
+  if (shift >= HAMT_HASH_BITS) {
+    for (i = 0; i < n->nslots; i++)
+      if (m->hops->equal_fun(us_car(n->slot[i]), key))
+        break;
+    if (i == n->nslots)
+      return node;
+    if (n->nslots == 2)
+      return n->slot[1 - i];
+    return hamt_copy_node(node, i, -1, nil);
+  } else {
+    u32_t bit = convert(u32_t, 1) << ((hv >> shift) & HAMT_MASK);
+    val slot;
 
-  if (equal && eql)
-    uw_throwf(error_s,
-              lit("make-hash: mutually exclusive :equal-based and :eql-based"),
-              nao);
+    if ((n->bitmap & bit) == 0)
+      return node;
 
-  if (wkeys) {
-    if (equal)
-      uw_throwf(error_s,
-                lit("make-hash: mutually exclusive :equal-based and :weak-keys"),
-                nao);
-    else
-      eql = t;
-  }
+    i = hamt_popcount(n->bitmap & (bit - 1));
+    slot = n->slot[i];
 
-  return null(eql);
+    if (consp(slot)) {
+      if (hamt_code(slot) != hv || !m->hops->equal_fun(us_car(slot), key))
+        return node;
+      sub = nil;
+    } else {
+      sub = hamt_dissoc_node(m, slot, shift + HAMT_BITS, key, hv);
+      if (sub == slot)
+        return node;
+    }
+
+    if (sub) {
+      if (shift > 0 && n->nslots == 1 && consp(sub))
+        return sub;
+      return hamt_replace_slot(node, i, sub);
+    }
+
+    if (n->nslots == 1)
+      return nil;
+
+    if (shift > 0 && n->nslots == 2 && consp(n->slot[1 - i]))
+      return n->slot[1 - i];
+
+    {
+      val copy = hamt_copy_node(node, i, -1, nil);
+      hamt_n(copy)->bitmap &= ~bit;
+      return copy;
+    }
+  }
 }
 
-val hashv(struct args *args)
+static void hamt_iter_mark(val iter)
 {
-  val wkeys = nil, wvals = nil, equal = nil, eql = nil, userdata = nil;
-  struct args_bool_key akv[] = {
-    { weak_keys_k, nil, &wkeys },
-    { weak_vals_k, nil, &wvals },
-    { equal_based_k, nil, &equal },
-    { eql_based_k, nil, &eql },
-    { userdata_k, t, &userdata }
-  };
-  val hash = (args_keys_extract(args, akv, sizeof akv / sizeof akv[0]),
-              make_hash(wkeys, wvals, equal_based_p(equal, eql, wkeys)));
-  if (userdata)
-    set_hash_userdata(hash, userdata);
-  return hash;
+  struct hamt_iter *hi = coerce(struct hamt_iter *, iter->co.handle);
+  gc_mark(hi->hamt);
 }
 
-val hashl(val arglist)
+static_def(struct cobj_ops hamt_iter_ops = cobj_ops_init(eq,
+                                                         cobj_print_op,
+                                                         cobj_destroy_free_op,
+                                                         hamt_iter_mark,
+                                                         cobj_eq_hash_op));
+
+/*
+ * A hamt iterator has the class of a hash iterator, so that hash-next
+ * and everything built on hash-begin works on both kinds of map.
+ */
+static val hamt_begin(val hamt)
 {
-  args_decl_list(args, ARGS_MIN, arglist);
-  return hashv(args);
+  struct hamt *m = coerce(struct hamt *, hamt->co.handle);
+  struct hamt_iter *hi = coerce(struct hamt_iter *,
+                                chk_calloc(1, sizeof *hi));
+  hi->hamt = hamt;
+  hi->depth = if3(m->root, 0, -1);
+  hi->node[0] = m->root;
+  hi->index[0] = 0;
+  return cobj(coerce(mem_t *, hi), hash_iter_s, &hamt_iter_ops);
 }
 
-val hash_construct(val hashl_args, val pairs)
+static val hamt_next(val iter)
 {
-  val hash = hashl(hashl_args);
+  struct hamt_iter *hi = coerce(struct hamt_iter *, iter->co.handle);
 
-  pairs = nullify(pairs);
+  while (hi->depth >= 0) {
+    struct hamt_node *n = hamt_n(hi->node[hi->depth]);
 
-  for (; pairs; pairs = cdr(pairs)) {
-    val pair = car(pairs);
-    sethash(hash, first(pair), second(pair));
+    if (hi->index[hi->depth] < n->nslots) {
+      val slot = n->slot[hi->index[hi->depth]++];
+
+      if (consp(slot))
+        return slot;
+
+      hi->depth++;
+      hi->node[hi->depth] = slot;
+      hi->index[hi->depth] = 0;
+    } else {
+      hi->depth--;
+    }
   }
 
-  return hash;
+  hi->hamt = nil;
+  return nil;
 }
 
-val hash_from_pairs_v(val pairs, struct args *hashv_args)
+static void hamt_print_op(val hamt, val out, val pretty, struct strm_ctx *ctx)
 {
-  return hash_construct(args_get_list(hashv_args), pairs);
-}
+  struct hamt *m = coerce(struct hamt *, hamt->co.handle);
+  val iter = hamt_begin(hamt), cell;
 
-val hash_from_alist_v(val alist, struct args *hashv_args)
-{
-  val hash = hashv(hashv_args);
+  put_string(lit("#<hamt"), out);
 
-  alist = nullify(alist);
+  if (m->hops == &hash_eql_ops) {
+    put_char(chr(' '), out);
+    obj_print_impl(eql_based_k, out, pretty, ctx);
+  }
 
-  for (; alist; alist = cdr(alist)) {
-    val pair = car(alist);
-    sethash(hash, car(pair), cdr(pair));
+  while ((cell = hamt_next(iter)) != nil) {
+    put_string(lit(" ("), out);
+    obj_print_impl(us_car(cell), out, pretty, ctx);
+    put_char(chr(' '), out);
+    obj_print_impl(us_cdr(cell), out, pretty, ctx);
+    put_char(chr(')'), out);
   }
 
-  return hash;
+  put_char(chr('>'), out);
 }
 
-val hash_list(val keys, struct args *hashv_args)
+static val hamt_equal_op(val left, val right)
 {
-  val hash = hashv(hashv_args);
+  struct hamt *l = coerce(struct hamt *, left->co.handle);
+  struct hamt *r = coerce(struct hamt *, right->co.handle);
+  val iter, cell;
 
-  keys = nullify(keys);
+  if (l->hops != r->hops || l->count != r->count)
+    return nil;
 
-  for (; keys; keys = cdr(keys)) {
-    val key = car(keys);
-    sethash(hash, key, key);
+  if (l->root == r->root)
+    return t;
+
+  iter = hamt_begin(left);
+
+  while ((cell = hamt_next(iter)) != nil) {
+    val key = us_car(cell);
+    u32_t hv = hamt_code(cell);
+    val found;
+
+    if (l->seed != r->seed)
+      hv = hamt_hash(r, key);
+
+    found = hamt_lookup(r, key, hv);
+
+    if (!found || !equal(us_cdr(found), us_cdr(cell)))
+      return nil;
   }
 
-  return hash;
+  return t;
 }
 
-val group_by(val func, val seq, struct args *hashv_args)
+static ucnum hamt_hash_op(val hamt, int *count, ucnum seed)
 {
-  val self = lit("group-by");
-  val hash = hashv(hashv_args);
+  ucnum out = 0;
+  val iter, cell;
 
-  if (vectorp(seq)) {
-    cnum i, len;
+  if ((*count)-- <= 0)
+    return 0;
 
-    for (i = 0, len = c_fixnum(length(seq), self); i < len; i++) {
-      val v = vecref(seq, num_fast(i));
-      pushhash(hash, funcall1(func, v), v);
-    }
-  } else {
-    for (; seq; seq = cdr(seq)) {
-      val v = car(seq);
-      pushhash(hash, funcall1(func, v), v);
-    }
-  }
+  iter = hamt_begin(hamt);
 
-  {
-    val iter = hash_begin(hash);
-    val cell;
+  while ((cell = hamt_next(iter)) != nil) {
+    out += equal_hash(cell, count, seed);
+    out &= NUM_MAX;
+  }
 
-    while ((cell = hash_next(iter)) != nil)
-      us_rplacd(cell, nreverse(us_cdr(cell)));
+  return out;
+}
 
-    return hash;
-  }
+static void hamt_mark(val obj)
+{
+  struct hamt *m = coerce(struct hamt *, obj->co.handle);
+  gc_mark(m->root);
 }
 
-val group_reduce(val hash, val by_fun, val reduce_fun, val seq,
-                 val initval, val filter_fun)
+static struct cobj_ops hamt_ops = cobj_ops_init(hamt_equal_op,
+                                                hamt_print_op,
+                                                cobj_destroy_free_op,
+                                                hamt_mark,
+                                                hamt_hash_op);
+
+static val hamt_make(val root, cnum count, ucnum seed, struct hash_ops *hops)
 {
-  val self = lit("group-reduce");
-  initval = default_null_arg(initval);
+  struct hamt *m = coerce(struct hamt *, chk_malloc(sizeof *m));
+  m->root = root;
+  m->count = count;
+  m->seed = seed;
+  m->hops = hops;
+  return cobj(coerce(mem_t *, m), hamt_s, &hamt_ops);
+}
 
-  if (vectorp(seq)) {
-    cnum i, len;
+static struct hamt *hamt_handle(val self, val obj)
+{
+  return coerce(struct hamt *, cobj_handle(self, obj, hamt_s));
+}
 
-    for (i = 0, len = c_fixnum(length(seq), self); i < len; i++) {
-      val v = vecref(seq, num_fast(i));
-      val key = funcall1(by_fun, v);
-      val new_p;
-      loc pcdr = gethash_l(self, hash, key, mkcloc(new_p));
+static val hamt_assoc_entry(val self, val hamt, val entry)
+{
+  struct hamt *m = hamt_handle(self, hamt);
+  int added = 0;
+  val root;
 
-      if (new_p)
-        set(pcdr, funcall2(reduce_fun, initval, v));
-      else
-        set(pcdr, funcall2(reduce_fun, deref(pcdr), v));
-    }
+  if (m->root) {
+    root = hamt_assoc_node(m, m->root, 0, entry, &added);
   } else {
-    for (; seq; seq = cdr(seq)) {
-      val v = car(seq);
-      val key = funcall1(by_fun, v);
-      val new_p;
-      loc pcdr = gethash_l(self, hash, key, mkcloc(new_p));
+    root = hamt_node(convert(u32_t, 1) << (hamt_code(entry) & HAMT_MASK), 1);
+    hamt_n(root)->slot[0] = entry;
+    added = 1;
+  }
+
+  return hamt_make(root, m->count + added, m->seed, m->hops);
+}
+
+val hamtv(struct args *args)
+{
+  val equal = nil, eql = nil;
+  struct args_bool_key akv[] = {
+    { equal_based_k, nil, &equal },
+    { eql_based_k, nil, &eql }
+  };
 
-      if (new_p)
-        set(pcdr, funcall2(reduce_fun, initval, v));
-      else
-        set(pcdr, funcall2(reduce_fun, deref(pcdr), v));
-    }
+  args_keys_extract(args, akv, sizeof akv / sizeof akv[0]);
+
+  return hamt_make(nil, 0,
+                   convert(ucnum, c_unum(if3(hash_seed_s, hash_seed, zero))),
+                   if3(equal_based_p(equal, eql, nil),
+                       &hash_equal_ops, &hash_eql_ops));
+}
+
+val hamt_from_alist_v(val alist, struct args *hamtv_args)
+{
+  val hamt = hamtv(hamtv_args);
+
+  for (alist = nullify(alist); alist; alist = cdr(alist)) {
+    val pair = car(alist);
+    hamt = hamt_assoc(hamt, car(pair), cdr(pair));
   }
 
-  if (!null_or_missing_p(filter_fun)) {
-    val iter = hash_begin(hash);
-    val cell;
+  return hamt;
+}
 
-    while ((cell = hash_next(iter)) != nil)
-      us_rplacd(cell, funcall1(filter_fun, us_cdr(cell)));
+val hamt_from_hash(val hash)
+{
+  val self = lit("hamt-from-hash");
+  struct hash *h = coerce(struct hash *, cobj_handle(self, hash, hash_s));
+  val hamt = hamt_make(nil, 0, h->seed, h->hops);
+  val iter = hash_begin(hash), cell;
+
+  while ((cell = hash_next(iter)) != nil) {
+    val entry = make_hash_entry(us_car(cell), us_cdr(cell),
+                                hamt_code(cell));
+    hamt = hamt_assoc_entry(self, hamt, entry);
   }
 
-  return hash;
+  return hamt;
 }
 
-static val hash_keys_lazy(val iter, val lcons)
+val hamtp(val obj)
 {
-  val cell = hash_next(iter);
-  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), us_car(cell))));
-  return nil;
+  return typeof(obj) == hamt_s ? t : nil;
 }
 
-val hash_keys(val hash)
+val hamt_count(val hamt)
 {
-  val iter = hash_begin(hash);
-  val cell = hash_next(iter);
-  if (!cell)
-    return nil;
-  return make_lazy_cons_car(func_f1(iter, hash_keys_lazy), us_car(cell));
+  val self = lit("hamt-count");
+  return num_fast(hamt_handle(self, hamt)->count);
 }
 
-static val hash_values_lazy(val iter, val lcons)
+val hamt_get(val hamt, val key, val notfound_val)
 {
-  val cell = hash_next(iter);
-  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), us_cdr(cell))));
-  return nil;
+  val self = lit("hamt-get");
+  struct hamt *m = hamt_handle(self, hamt);
+  val entry = hamt_lookup(m, key, hamt_hash(m, key));
+  return if3(entry, us_cdr(entry), default_null_arg(notfound_val));
 }
 
-val hash_values(val hash)
+val hamt_assoc(val hamt, val key, val value)
 {
-  val iter = hash_begin(hash);
-  val cell = hash_next(iter);
-  if (!cell)
-    return nil;
-  return make_lazy_cons_car(func_f1(iter, hash_values_lazy), us_cdr(cell));
+  val self = lit("hamt-assoc");
+  struct hamt *m = hamt_handle(self, hamt);
+  u32_t hv = hamt_hash(m, key);
+  val entry = hamt_lookup(m, key, hv);
+
+  if (entry && us_cdr(entry) == value)
+    return hamt;
+
+  return hamt_assoc_entry(self, hamt, make_hash_entry(key, value, hv));
 }
 
-static val hash_pairs_lazy(val iter, val lcons)
+val hamt_dissoc(val hamt, val key)
 {
-  val cell = hash_next(iter);
-  us_rplacd(lcons, if2(cell,
-                       make_lazy_cons_car(us_lcons_fun(lcons),
-                                          cons(us_car(cell),
-                                               cons(us_cdr(cell),
-                                                    nil)))));
-  return nil;
+  val self = lit("hamt-dissoc");
+  struct hamt *m = hamt_handle(self, hamt);
+  val root;
+
+  if (!m->root)
+    return hamt;
+
+  root = hamt_dissoc_node(m, m->root, 0, key, hamt_hash(m, key));
+
+  if (root == m->root)
+    return hamt;
+
+  return hamt_make(root, m->count - 1, m->seed, m->hops);
 }
 
-val hash_pairs(val hash)
+/*
+ * A cache is a hash table bounded by a fixed number of entries, from which
+ * the least recently used entries are evicted approximately, by the CLOCK
+ * algorithm. Each entry occupies a slot in a ring; the table maps each key
+ * to a cell (slot . value). A hit sets the slot's reference flag; a miss
+ * which needs a slot sweeps the clock hand around the ring, clearing
+ * reference flags until it reaches an unreferenced slot, whose entry is
+ * evicted. Thus a hit costs one hash lookup and no list surgery.
+ *
+ * With weak values, the values live in a separate weak-valued table, since
+ * the cells would otherwise keep them reachable; a value reclaimed by the
+ * garbage collector then reads as a miss, and its slot is reused when the
+ * same key is stored again, or when the hand reaches it.
+ */
+
+enum cache_ref { CACHE_UNREF, CACHE_REF, CACHE_VACANT };
+
+struct cache {
+  val hash, vals, ring;
+  unsigned char *ref;
+  cnum limit, count, hand;
+  ucnum hits, misses, evictions;
+};
+
+val cache_s;
+
+static void cache_mark(val obj)
 {
-  val iter = hash_begin(hash);
-  val cell = hash_next(iter);
-  if (!cell)
-    return nil;
-  return make_lazy_cons_car(func_f1(iter, hash_pairs_lazy),
-                            cons(us_car(cell), cons(us_cdr(cell), nil)));
+  struct cache *c = coerce(struct cache *, obj->co.handle);
+  gc_mark(c->hash);
+  gc_mark(c->vals);
+  gc_mark(c->ring);
 }
 
-static val hash_alist_lazy(val iter, val lcons)
+static void cache_destroy(val obj)
 {
-  val cell = hash_next(iter);
-  us_rplacd(lcons, if2(cell, make_lazy_cons_car(us_lcons_fun(lcons), cell)));
-  return nil;
+  struct cache *c = coerce(struct cache *, obj->co.handle);
+  free(c->ref);
+  free(c);
 }
 
-val hash_alist(val hash)
+static struct cobj_ops cache_ops = cobj_ops_init(eq,
+                                                 cobj_print_op,
+                                                 cache_destroy,
+                                                 cache_mark,
+                                                 cobj_eq_hash_op);
+
+static struct cache *cache_handle(val self, val obj)
 {
-  val iter = hash_begin(hash);
-  val cell = hash_next(iter);
-  if (!cell)
-    return nil;
-  return make_lazy_cons_car(func_f1(iter, hash_alist_lazy), cell);
+  return coerce(struct cache *, cobj_handle(self, obj, cache_s));
 }
 
-val hash_uni(val hash1, val hash2, val join_func)
+val make_cache(val limit, val weak_vals, val equal_based)
 {
-  val self = lit("hash-uni");
-  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
-  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+  val self = lit("make-cache");
+  cnum lim = c_num(limit);
 
-  if (h1->hops != h2->hops)
-    uw_throwf(error_s, lit("~a: ~s and ~s are incompatible hashes"),
-              self, hash1, hash2, nao);
+  if (lim <= 0)
+    uw_throwf(error_s, lit("~a: limit ~s must be positive"),
+              self, limit, nao);
 
   {
-    val hout = make_similar_hash(hash1);
-    val hiter, entry;
+    val ring = vector(limit, nil);
+    val hash = make_hash(nil, nil, equal_based);
+    val vals = if2(weak_vals, make_hash(nil, t, equal_based));
+    struct cache *c;
 
-    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      sethash(hout, us_car(entry), us_cdr(entry));
-    }
+    hash_reserve(hash, limit);
 
-    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      if (missingp(join_func)) {
-        sethash(hout, us_car(entry), us_cdr(entry));
-      } else {
-        val new_p;
-        loc ptr = gethash_l(self, hout, us_car(entry), mkcloc(new_p));
-        if (new_p)
-          sethash(hout, us_car(entry), us_cdr(entry));
-        else
-          set(ptr, funcall2(join_func, us_cdr(entry), deref(ptr)));
-      }
-    }
+    c = coerce(struct cache *, chk_calloc(1, sizeof *c));
+    c->ref = coerce(unsigned char *, chk_calloc(lim, 1));
+    c->limit = lim;
+    c->ring = ring;
+    c->hash = hash;
+    c->vals = vals;
 
-    return hout;
+    return cobj(coerce(mem_t *, c), cache_s, &cache_ops);
   }
 }
 
-val hash_diff(val hash1, val hash2)
+val make_cache_v(val limit, struct args *args)
 {
-  val self = lit("hash-diff");
-  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
-  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+  val wvals = nil, equal = nil, eql = nil;
+  struct args_bool_key akv[] = {
+    { weak_vals_k, nil, &wvals },
+    { equal_based_k, nil, &equal },
+    { eql_based_k, nil, &eql }
+  };
 
-  if (h1->hops != h2->hops)
-    uw_throwf(error_s, lit("~a: ~s and ~a are incompatible hashes"),
-              self, hash1, hash2, nao);
+  args_keys_extract(args, akv, sizeof akv / sizeof akv[0]);
 
-  {
-    val hout = copy_hash(hash1);
-    val hiter, entry;
+  return make_cache(limit, wvals, equal_based_p(equal, eql, nil));
+}
 
-    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      remhash(hout, us_car(entry));
-    }
+/*
+ * Returns a cons whose cdr is the cached value, or nil on a miss.
+ */
+static val cache_find(struct cache *c, val key)
+{
+  val cell = gethash(c->hash, key);
+  val found = if3(cell && c->vals, gethash_e(lit("cache-get"), c->vals, key),
+                  cell);
 
-    return hout;
+  if (found) {
+    c->ref[c_n(us_car(cell))] = CACHE_REF;
+    c->hits++;
+  } else {
+    c->misses++;
   }
+
+  return found;
 }
 
-val hash_symdiff(val hash1, val hash2)
+static cnum cache_slot(struct cache *c)
 {
-  val self = lit("hash-symdiff");
-  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
-  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+  if (c->count < c->limit)
+    return c->count++;
 
-  if (h1->hops != h2->hops)
-    uw_throwf(error_s, lit("~a: ~s and ~a are incompatible hashes"),
-              self, hash1, hash2, nao);
+  for (;;) {
+    cnum i = c->hand;
 
-  {
-    val hout = make_similar_hash(hash1);
-    val hiter, entry;
+    c->hand = (i + 1) % c->limit;
 
-    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      if (!gethash_e(self, hash2, us_car(entry)))
-        sethash(hout, us_car(entry), us_cdr(entry));
+    switch (c->ref[i]) {
+    case CACHE_REF:
+      c->ref[i] = CACHE_UNREF;
+      continue;
+    case CACHE_UNREF:
+      {
+        val key = c->ring->v.vec[i];
+        remhash(c->hash, key);
+        if (c->vals)
+          remhash(c->vals, key);
+        c->evictions++;
+      }
+      /* fallthrough */
+    case CACHE_VACANT:
+      return i;
     }
+  }
+}
 
-    for (hiter = hash_begin(hash2), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      if (!gethash_e(self, hash1, us_car(entry)))
-        sethash(hout, us_car(entry), us_cdr(entry));
-    }
+static void cache_store(struct cache *c, val key, val value)
+{
+  val cell = gethash(c->hash, key);
 
-    return hout;
+  if (!cell) {
+    cnum slot = cache_slot(c);
+    c->ref[slot] = CACHE_UNREF;
+    set(mkloc(c->ring->v.vec[slot], c->ring), key);
+    cell = cons(num_fast(slot), nil);
+    sethash(c->hash, key, cell);
   }
+
+  if (c->vals)
+    sethash(c->vals, key, value);
+  else
+    us_rplacd(cell, value);
 }
 
-val hash_isec(val hash1, val hash2, val join_func)
+val cache_get(val cache, val key, val notfound_val)
 {
-  val self = lit("hash-isec");
-  struct hash *h1 = coerce(struct hash *, cobj_handle(self, hash1, hash_s));
-  struct hash *h2 = coerce(struct hash *, cobj_handle(self, hash2, hash_s));
+  val self = lit("cache-get");
+  val found = cache_find(cache_handle(self, cache), key);
+  return if3(found, us_cdr(found), default_null_arg(notfound_val));
+}
 
-  if (h1->hops != h2->hops)
-    uw_throwf(error_s, lit("~a: ~s and ~s are incompatible hashes"),
-              self, hash1, hash2, nao);
+val cache_put(val cache, val key, val value)
+{
+  val self = lit("cache-put");
+  cache_store(cache_handle(self, cache), key, value);
+  return value;
+}
 
-  {
-    val hout = make_similar_hash(hash1);
-    val hiter, entry;
+val cache_del(val cache, val key)
+{
+  val self = lit("cache-del");
+  struct cache *c = cache_handle(self, cache);
+  val cell = remhash(c->hash, key);
 
-    for (hiter = hash_begin(hash1), entry = hash_next(hiter);
-         entry;
-         entry = hash_next(hiter))
-    {
-      val found = gethash_e(self, hash2, us_car(entry));
-      if (found) {
-        if (missingp(join_func))
-          sethash(hout, us_car(entry), us_cdr(entry));
-        else
-          sethash(hout, us_car(entry), funcall2(join_func, us_cdr(entry), us_cdr(found)));
-      }
-    }
+  if (!cell)
+    return nil;
 
-    return hout;
+  {
+    cnum slot = c_n(us_car(cell));
+    c->ref[slot] = CACHE_VACANT;
+    set(mkloc(c->ring->v.vec[slot], c->ring), nil);
   }
+
+  if (c->vals)
+    return remhash(c->vals, key);
+
+  return us_cdr(cell);
 }
 
-val hash_subset(val hash1, val hash2)
+val cache_clear(val cache)
 {
-  val hiter, entry;
+  val self = lit("cache-clear");
+  struct cache *c = cache_handle(self, cache);
+  val count = hash_count(c->hash);
 
-  for (hiter = hash_begin(hash1), entry = hash_next(hiter);
-       entry;
-       entry = hash_next(hiter))
-  {
-    if (!inhash(hash2, us_car(entry), colon_k))
-      return nil;
-  }
+  clearhash(c->hash);
+  if (c->vals)
+    clearhash(c->vals);
+  set(mkloc(c->ring, cache), vector(num_fast(c->limit), nil));
+  memset(c->ref, CACHE_UNREF, c->limit);
+  c->count = c->hand = 0;
 
-  return t;
+  return count;
 }
 
-val hash_proper_subset(val hash1, val hash2)
+val cache_count(val cache)
 {
-  return and2(hash_subset(hash1, hash2),
-              null(numeq(hash_count(hash1), hash_count(hash2))));
+  val self = lit("cache-count");
+  return hash_count(cache_handle(self, cache)->hash);
 }
 
-val hash_update(val hash, val fun)
+val cache_stats(val cache)
 {
-  val iter = hash_begin(hash);
-  val cell;
-  while ((cell = hash_next(iter)) != nil) {
-    loc ptr = mkloc(*us_cdr_p(cell), cell);
-    set(ptr, funcall1(fun, deref(ptr)));
-  }
-  return hash;
+  val self = lit("cache-stats");
+  struct cache *c = cache_handle(self, cache);
+  return list(unum(c->hits), unum(c->misses), unum(c->evictions), nao);
 }
 
-val hash_update_1(val hash, val key, val fun, val init)
+val cachep(val obj)
 {
-  val self = lit("hash-update-1");
+  return typeof(obj) == cache_s ? t : nil;
+}
 
-  if (missingp(init)) {
-    val cons = gethash_e(self, hash, key);
-    if (cons) {
-      val data = us_cdr(cons);
-      us_rplacd(cons, funcall1(fun, data));
-      return data;
-    }
-    return nil;
+static val memoize_fun(val env, struct args *args)
+{
+  val fun = us_car(env);
+  struct cache *c = coerce(struct cache *, us_cdr(env)->co.handle);
+  val key = args_copy_to_list(args);
+  val found = cache_find(c, key);
+
+  if (found) {
+    return us_cdr(found);
   } else {
-    val new_p;
-    loc place = gethash_l(self, hash, key, mkcloc(new_p));
-    if (new_p)
-      set(place, funcall1(fun, init));
-    else
-      set(place, funcall1(fun, deref(place)));
-    return deref(place);
+    val value = generic_funcall(fun, args);
+    cache_store(c, key, value);
+    return value;
   }
 }
 
-val hash_revget(val hash, val value, val test, val keyfun)
+val memoize(val fun, val cache_or_limit)
 {
-  val iter = hash_begin(hash);
-  val cell;
+  val self = lit("memoize");
 
-  test = default_arg(test, eql_f);
-  keyfun = default_arg(keyfun, identity_f);
+  if (cachep(cache_or_limit)) {
+    struct cache *c = cache_handle(self, cache_or_limit);
+    struct hash *h = coerce(struct hash *, c->hash->co.handle);
 
-  while ((cell = hash_next(iter)) != nil) {
-    if (funcall2(test, value, funcall1(keyfun, us_cdr(cell))))
-      return us_car(cell);
+    if (h->hops != &hash_equal_ops)
+      uw_throwf(error_s, lit("~a: ~s is not an equal-based cache"),
+                self, cache_or_limit, nao);
+
+    return func_f0v(cons(fun, cache_or_limit), memoize_fun);
   }
 
-  return nil;
+  return func_f0v(cons(fun, make_cache(default_arg(cache_or_limit,
+                                                   num_fast(256)),
+                                       nil, t)),
+                  memoize_fun);
 }
 
+
 static val set_hash_str_limit(val lim)
 {
   val old = num(hash_str_limit);
   hash_str_limit = c_num(lim);
+  memset(str_hash_cache, 0, sizeof str_hash_cache);
   return old;
 }
 
@@ -1601,7 +3237,11 @@ void hash_init(void)
   equal_based_k = intern(lit("equal-based"), keyword_package);
   eql_based_k = intern(lit("eql-based"), keyword_package);
   userdata_k = intern(lit("userdata"), keyword_package);
+  ordered_k = intern(lit("ordered"), keyword_package);
   hash_seed_s = intern(lit("*hash-seed*"), user_package);
+  hamt_s = intern(lit("hamt"), user_package);
+  cache_s = intern(lit("cache"), user_package);
+  hamt_node_s = intern(lit("hamt-node"), system_package);
   val ghu = func_n1(get_hash_userdata);
 
   reg_var(hash_seed_s, zero);
@@ -1621,6 +3261,8 @@ void hash_init(void)
   reg_fun(intern(lit("remhash"), user_package), func_n2(remhash));
   reg_fun(intern(lit("clearhash"), user_package), func_n1(clearhash));
   reg_fun(intern(lit("hash-count"), user_package), func_n1(hash_count));
+  reg_fun(intern(lit("hash-reserve"), user_package), func_n2(hash_reserve));
+  reg_fun(intern(lit("hash-shrink"), user_package), func_n1(hash_shrink));
   reg_fun(intern(lit("get-hash-userdata"), user_package), ghu);
   reg_fun(intern(lit("hash-userdata"), user_package), ghu);
   reg_fun(intern(lit("set-hash-userdata"), user_package),
@@ -1648,6 +3290,24 @@ void hash_init(void)
   reg_fun(intern(lit("hash-revget"), user_package), func_n4o(hash_revget, 2));
   reg_fun(intern(lit("hash-begin"), user_package), func_n1(hash_begin));
   reg_fun(intern(lit("hash-next"), user_package), func_n1(hash_next));
+  reg_fun(hamt_s, func_n0v(hamtv));
+  reg_fun(intern(lit("hamt-from-alist"), user_package),
+          func_n1v(hamt_from_alist_v));
+  reg_fun(intern(lit("hamt-from-hash"), user_package), func_n1(hamt_from_hash));
+  reg_fun(intern(lit("hamtp"), user_package), func_n1(hamtp));
+  reg_fun(intern(lit("hamt-count"), user_package), func_n1(hamt_count));
+  reg_fun(intern(lit("hamt-get"), user_package), func_n3o(hamt_get, 2));
+  reg_fun(intern(lit("hamt-assoc"), user_package), func_n3(hamt_assoc));
+  reg_fun(intern(lit("hamt-dissoc"), user_package), func_n2(hamt_dissoc));
+  reg_fun(intern(lit("make-cache"), user_package), func_n1v(make_cache_v));
+  reg_fun(intern(lit("cache-get"), user_package), func_n3o(cache_get, 2));
+  reg_fun(intern(lit("cache-put"), user_package), func_n3(cache_put));
+  reg_fun(intern(lit("cache-del"), user_package), func_n2(cache_del));
+  reg_fun(intern(lit("cache-clear"), user_package), func_n1(cache_clear));
+  reg_fun(intern(lit("cache-count"), user_package), func_n1(cache_count));
+  reg_fun(intern(lit("cache-stats"), user_package), func_n1(cache_stats));
+  reg_fun(intern(lit("cachep"), user_package), func_n1(cachep));
+  reg_fun(intern(lit("memoize"), user_package), func_n2o(memoize, 1));
   reg_fun(intern(lit("set-hash-str-limit"), system_package),
           func_n1(set_hash_str_limit));
   reg_fun(intern(lit("set-hash-rec-limit"), system_package),
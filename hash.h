@@ -26,6 +26,7 @@
  */
 
 extern val weak_keys_k, weak_vals_k, equal_based_k, eql_based_k, userdata_k;
+extern val ordered_k, hamt_s, cache_s;
 
 ucnum equal_hash(val obj, int *count, ucnum);
 val make_seeded_hash(val weak_keys, val weak_vals, val equal_based, val seed);
@@ -41,6 +42,8 @@ val sethash(val hash, val key, val value);
 val pushhash(val hash, val key, val value);
 val remhash(val hash, val key);
 val clearhash(val hash);
+val hash_reserve(val hash, val count);
+val hash_shrink(val hash);
 val hash_count(val hash);
 val us_hash_count(val hash);
 val get_hash_userdata(val hash);
@@ -73,7 +76,27 @@ val hash_proper_subset(val hash1, val hash2);
 val hash_update(val hash, val fun);
 val hash_update_1(val hash, val key, val fun, val init);
 val hash_revget(val hash, val value, val test, val keyfun);
+val hamtv(struct args *args);
+val hamt_from_alist_v(val alist, struct args *hamtv_args);
+val hamt_from_hash(val hash);
+val hamtp(val obj);
+val hamt_count(val hamt);
+val hamt_get(val hamt, val key, val notfound_val);
+val hamt_assoc(val hamt, val key, val value);
+val hamt_dissoc(val hamt, val key);
+val make_cache(val limit, val weak_vals, val equal_based);
+val make_cache_v(val limit, struct args *args);
+val cache_get(val cache, val key, val notfound_val);
+val cache_put(val cache, val key, val value);
+val cache_del(val cache, val key);
+val cache_clear(val cache);
+val cache_count(val cache);
+val cache_stats(val cache);
+val cachep(val obj);
+val memoize(val fun, val cache_or_limit);
 
+void str_hash_invalidate(val str);
+void hash_remark_weak(void);
 void hash_process_weak(void);
 
 INLINE loc gethash_l(val self, val hash, val key, loc new_p)
@@ -50,6 +50,7 @@
 #include "arith.h"
 #include "rand.h"
 #include "hash.h"
+#include "cdb.h"
 #include "signal.h"
 #include "unwind.h"
 #include "args.h"
@@ -177,7 +178,7 @@ val identity(val obj)
   return obj;
 }
 
-static val code2type(int code)
+val code2type(int code)
 {
   switch (convert(type_t, code)) {
   case NIL: return null_s;
@@ -300,7 +301,7 @@ seq_info_t seq_info(val obj)
   } else {
     val cls = obj->co.cls;
 
-    if (cls == hash_s) {
+    if (cls == hash_s || cls == hamt_s || cls == cdb_s) {
       ret.kind = SEQ_HASHLIKE;
     } else if (cls == carray_s) {
       ret.kind = SEQ_VECLIKE;
@@ -2797,6 +2798,8 @@ mem_t *chk_malloc(size_t size)
   if (size && ptr == 0)
     oom();
   malloc_bytes += size;
+  if (alloc_prof_period)
+    gc_prof_malloc(size);
   return ptr;
 }
 
@@ -2819,6 +2822,8 @@ mem_t *chk_calloc(size_t n, size_t size)
   if (size && ptr == 0)
     oom();
   malloc_bytes += total;
+  if (alloc_prof_period)
+    gc_prof_malloc(total);
   return ptr;
 }
 
@@ -2831,6 +2836,8 @@ mem_t *chk_realloc(mem_t *old, size_t size)
   if (size != 0 && newptr == 0)
     oom();
   malloc_bytes += size;
+  if (alloc_prof_period)
+    gc_prof_malloc(size);
   return newptr;
 }
 
@@ -2974,7 +2981,7 @@ val cons(val car, val cdr)
     setcheck(obj, car);
     setcheck(obj, cdr);
   } else {
-    obj = make_obj();
+    obj = make_cons_obj();
     obj->c.type = CONS;
   }
 
@@ -3461,6 +3468,7 @@ val string_extend(val str, val tail)
     }
 
     set(mkloc(str->st.len, str), num_fast(len + delta));
+    str_hash_invalidate(str);
 
     if (stringp(tail)) {
       wmemcpy(str->st.str + len, c_str(tail), delta + 1);
@@ -3762,6 +3770,8 @@ val replace_str(val str_in, val items, val from, val to)
               str_in, typeof(str_in), nao);
   }
 
+  str_hash_invalidate(str_in);
+
   if (listp(from)) {
     val where = from;
     val len = length_str(str_in);
@@ -4867,8 +4877,10 @@ val chr_str_set(val str, val ind, val chr)
 
   if (lazy_stringp(str)) {
     lazy_str_force_upto(str, ind);
+    str_hash_invalidate(str->ls.prefix);
     str->ls.prefix->st.str[index] = c_chr(chr);
   } else {
+    str_hash_invalidate(str);
     str->st.str[index] = c_chr(chr);
   }
 
@@ -9661,17 +9673,69 @@ val in(val seq, val item, val testfun, val keyfun)
   }
 }
 
+/*
+ * With equal or eql as the test, and neither sequence small, the set
+ * operations below search a temporary hash of the keys of the searched
+ * sequence, rather than comparing every pair of elements.
+ * Below about SET_HASH_MIN elements on either side, the pairwise
+ * comparisons are cheaper than hashing every key.
+ */
+enum { SET_HASH_MIN = 12 };
+
+static int seq_has_min(val self, val seq, cnum min)
+{
+  seq_iter_t si;
+  val el;
+
+  seq_iter_init(self, &si, seq);
+
+  while (min > 0 && seq_get(&si, &el))
+    min--;
+
+  return min == 0;
+}
+
+static val set_op_hash(val self, val seq, val searched,
+                       val testfun, val keyfun)
+{
+  seq_iter_t si;
+  val el, hash;
+
+  if ((testfun != equal_f && testfun != eql_f) ||
+      !seq_has_min(self, seq, SET_HASH_MIN) ||
+      !seq_has_min(self, searched, SET_HASH_MIN))
+    return nil;
+
+  hash = make_hash(nil, nil, tnil(testfun == equal_f));
+
+  seq_iter_init(self, &si, searched);
+
+  while (seq_get(&si, &el))
+    sethash(hash, funcall1(keyfun, el), t);
+
+  return hash;
+}
+
 val diff(val seq1, val seq2, val testfun, val keyfun)
 {
   val self = lit("diff");
   list_collect_decl (out, ptail);
   seq_iter_t si1, si2;
-  val el1;
+  val el1, hash;
 
   testfun = default_arg(testfun, equal_f);
   keyfun = default_arg(keyfun, identity_f);
 
   seq_iter_init(self, &si1, seq1);
+
+  if ((hash = set_op_hash(self, seq1, seq2, testfun, keyfun)) != nil) {
+    while (seq_get(&si1, &el1))
+      if (!gethash_e(self, hash, funcall1(keyfun, el1)))
+        ptail = list_collect(ptail, el1);
+
+    return make_like(out, seq1);
+  }
+
   seq_iter_init(self, &si2, seq2);
 
   while (seq_get(&si1, &el1)) {
@@ -9699,8 +9763,10 @@ val diff(val seq1, val seq2, val testfun, val keyfun)
 
 val set_diff(val list1, val list2, val testfun, val keyfun)
 {
+  val self = lit("set-diff");
   list_collect_decl (out, ptail);
   val list_orig = list1;
+  val hash;
 
   list1 = nullify(list1);
   list2 = nullify(list2);
@@ -9708,6 +9774,8 @@ val set_diff(val list1, val list2, val testfun, val keyfun)
   testfun = default_arg(testfun, equal_f);
   keyfun = default_arg(keyfun, identity_f);
 
+  hash = set_op_hash(self, list1, list2, testfun, keyfun);
+
   for (; list1; list1 = cdr(list1)) {
     /* optimization: list2 is a tail of list1, and so we
        are done, unless the application has a weird test function. */
@@ -9717,7 +9785,9 @@ val set_diff(val list1, val list2, val testfun, val keyfun)
       val item = car(list1);
       val list1_key = funcall1(keyfun, item);
 
-      if (!member(list1_key, list2, testfun, keyfun))
+      if (hash
+          ? !gethash_e(self, hash, list1_key)
+          : !member(list1_key, list2, testfun, keyfun))
         ptail = list_collect(ptail, item);
     }
   }
@@ -9773,12 +9843,21 @@ val isec(val seq1, val seq2, val testfun, val keyfun)
   val self = lit("isec");
   list_collect_decl (out, ptail);
   seq_iter_t si1, si2;
-  val el1;
+  val el1, hash;
 
   testfun = default_arg(testfun, equal_f);
   keyfun = default_arg(keyfun, identity_f);
 
   seq_iter_init(self, &si1, seq1);
+
+  if ((hash = set_op_hash(self, seq1, seq2, testfun, keyfun)) != nil) {
+    while (seq_get(&si1, &el1))
+      if (gethash_e(self, hash, funcall1(keyfun, el1)))
+        ptail = list_collect(ptail, el1);
+
+    return make_like(out, seq1);
+  }
+
   seq_iter_init(self, &si2, seq2);
 
   while (seq_get(&si1, &el1)) {
@@ -9805,7 +9884,7 @@ val uni(val seq1, val seq2, val testfun, val keyfun)
   val self = lit("uni");
   list_collect_decl (out, ptail);
   seq_iter_t si1, si2;
-  val el1, el2;
+  val el1, el2, hash;
 
   testfun = default_arg(testfun, equal_f);
   keyfun = default_arg(keyfun, identity_f);
@@ -9816,11 +9895,21 @@ val uni(val seq1, val seq2, val testfun, val keyfun)
   while (seq_get(&si1, &el1))
     ptail = list_collect(ptail, el1);
 
+  hash = set_op_hash(self, seq2, seq1, testfun, keyfun);
+
   while (seq_get(&si2, &el2)) {
     val el2_key = funcall1(keyfun, el2);
 
-    if (!member(el2_key, out, testfun, keyfun))
+    if (hash) {
+      val cell = gethash_c(self, hash, el2_key, nulloc);
+
+      if (!us_cdr(cell)) {
+        us_rplacd(cell, t);
+        ptail = list_collect(ptail, el2);
+      }
+    } else if (!member(el2_key, out, testfun, keyfun)) {
       ptail = list_collect(ptail, el2);
+    }
   }
 
   return make_like(out, seq1);
@@ -9883,6 +9972,10 @@ val length(val seq)
   case COBJ:
     if (seq->co.cls == hash_s)
       return hash_count(seq);
+    if (seq->co.cls == hamt_s)
+      return hamt_count(seq);
+    if (seq->co.cls == cdb_s)
+      return cdb_count(seq);
     if (seq->co.cls == carray_s)
       return length_carray(seq);
     if (obj_struct_p(seq)) {
@@ -9922,6 +10015,10 @@ val empty(val seq)
   case COBJ:
     if (seq->co.cls == hash_s)
       return eq(hash_count(seq), zero);
+    if (seq->co.cls == hamt_s)
+      return eq(hamt_count(seq), zero);
+    if (seq->co.cls == cdb_s)
+      return eq(cdb_count(seq), zero);
     if (obj_struct_p(seq)) {
       val length_meth = maybe_slot(seq, length_s);
       val nullify_meth = if2(nilp(length_meth), maybe_slot(seq, nullify_s));
@@ -11989,6 +12086,7 @@ void init(val *stack_bottom)
   uw_init();
   eval_init();
   hash_init();
+  cdb_init();
   struct_init();
   itypes_init();
   buf_init();
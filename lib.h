@@ -102,8 +102,8 @@ typedef unsigned char mem_t;
 
 struct any {
   obj_common;
-  mem_t *dummy[2];
-  val next; /* GC free list */
+  mem_t *dummy;
+  val next; /* GC free list; overlays cons cdr */
 };
 
 struct cons {
@@ -525,6 +525,7 @@ extern alloc_bytes_t malloc_bytes;
 extern alloc_bytes_t gc_bytes;
 
 val identity(val obj);
+val code2type(int code);
 val typeof(val obj);
 val subtypep(val sub, val sup);
 val typep(val obj, val type);
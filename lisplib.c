@@ -687,7 +687,7 @@ static val asm_set_entries(val dlt, val fun)
     nil
   };
   val name[] = {
-    lit("disassemble"),
+    lit("disassemble"), lit("opcode-pair-report"),
     nil
   };
 
@@ -712,6 +712,7 @@ static val compiler_set_entries(val dlt, val fun)
   val name[] = {
     lit("compile-toplevel"), lit("compile-file"), lit("compile"),
     lit("with-compilation-unit"), lit("dump-compiled-objects"),
+    lit("*opt-level*"),
     nil
   };
 
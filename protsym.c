@@ -40,65 +40,66 @@ extern val be_double_s, be_float_s, be_int16_s, be_int32_s, be_int64_s;
 extern val be_uint16_s, be_uint32_s, be_uint64_s, bignum_s, bind_s;
 extern val bit_s, bit_s, blksize_k, blksize_s, block_s;
 extern val block_star_s, blocks_k, blocks_s, bool_s, bstr_d_s;
-extern val bstr_s, buf_d_s, buf_s, byte_oriented_k, call_s;
-extern val car_s, carray_s, caseq_s, caseq_star_s, caseql_s;
-extern val caseql_star_s, casequal_s, casequal_star_s, cases_s, cat_s;
-extern val catch_s, cdigit_k, cdr_s, ceil1_s, ceil_s;
-extern val char_s, chars_k, choose_s, chr_s, chset_s;
-extern val circref_s, clear_error_s, close_s, closure_s, cobj_s;
-extern val coll_s, collect_each_s, collect_each_star_s, collect_s, colon_k;
-extern val compile_only_s, compl_s, compound_s, cond_s, cons_s;
-extern val continue_k, continue_s, cos_s, counter_k, cptr_s;
-extern val cset_s, cspace_k, ctime_k, ctime_s, cword_char_k;
-extern val data_s, day_s, decline_k, defex_s, deffilter_s;
-extern val define_s, defmacro_s, defparm_s, defparml_s, defr_warning_s;
-extern val defsymacro_s, defun_s, defvar_s, defvarl_s, dev_k;
-extern val dev_s, digit_k, div_s, do_s, dohash_s;
-extern val double_s, downcase_k, dst_s, dvbind_s, dwim_s;
-extern val each_op_s, each_s, each_star_s, elif_s, else_s;
-extern val empty_s, enum_s, enumed_s, env_k, env_s;
-extern val eof_s, eol_s, eq_s, eql_based_k, eql_s;
-extern val equal_based_k, equal_s, error_s, eval_error_s, eval_only_s;
-extern val evenp_s, exp_s, expr_s, expt_s, exptmod_s;
-extern val fail_s, fbind_s, fd_k, ffi_call_desc_s, ffi_closure_s;
-extern val ffi_type_s, file_error_s, fill_buf_s, filter_k, filter_s;
-extern val filters_s, finally_s, finish_k, first_s, fixnum_s;
-extern val flatten_s, flet_s, float_s, floor1_s, floor_s;
-extern val flush_s, for_op_s, for_s, for_star_s, force_s;
-extern val forget_s, form_k, format_s, freeform_s, from_current_k;
-extern val from_end_k, from_list_s, from_start_k, frombase64_k, fromhtml_k;
-extern val frompercent_k, fromurl_k, fun_k, fun_s, fuzz_s;
-extern val gap_k, gather_s, ge_s, gen_s, generate_s;
-extern val gensym_counter_s, get_byte_s, get_char_s, get_error_s, get_error_str_s;
-extern val get_fd_s, get_line_s, get_prop_s, gid_k, gid_s;
-extern val gmtoff_s, greedy_k, gt_s, gun_s, handler_bind_s;
-extern val hash_construct_s, hash_iter_s, hash_lit_s, hash_s, hash_seed_s;
-extern val hextoint_k, hour_s, iapply_s, identity_s, if_s;
-extern val iflet_s, in_package_s, inc_s, include_s, init_k;
-extern val ino_k, ino_s, int16_s, int32_s, int64_s;
-extern val int8_s, int_s, integer_s, internal_error_s, into_k;
-extern val intr_s, inv_div_s, inv_minus_s, isqrt_s, keyword_package_s;
-extern val labels_s, lambda_s, lambda_set_s, last_s, lbind_s;
-extern val lcons_s, le_double_s, le_float_s, le_int16_s, le_int32_s;
-extern val le_int64_s, le_s, le_uint16_s, le_uint32_s, le_uint64_s;
-extern val length_s, let_s, let_star_s, lfilt_k, line_s;
-extern val lines_k, list_k, list_s, list_star_s, listener_greedy_eval_s;
-extern val listener_hist_len_s, listener_multi_line_p_s, listener_pprint_s, listener_sel_inclusive_p_s, lists_k;
-extern val lit_s, load_path_s, load_recursive_s, load_s, load_time_lit_s;
-extern val load_time_s, local_s, log10_s, log2_s, log_s;
-extern val logand_s, logcount_s, logior_s, lognot1_s, lognot_s;
-extern val logtrunc_s, logxor_s, long_s, longest_k, lstr_s;
-extern val lt_s, mac_param_bind_s, macro_s, macro_time_s, macrolet_s;
-extern val make_struct_lit_s, mandatory_k, maxgap_k, maxtimes_k, maybe_s;
-extern val mdo_s, memq_s, memql_s, memqual_s, merge_s;
-extern val meth_s, min_s, mingap_k, mintimes_k, minus_s;
-extern val minusp_s, mod_s, mod_s, mode_k, mode_s;
-extern val modlast_s, month_s, mtime_k, mtime_s, mul_s;
-extern val name_k, name_s, named_k, neg_s, next_s;
-extern val next_spec_k, nlink_k, nlink_s, none_s, nongreedy_s;
-extern val not_s, nothrow_k, noval_s, null_s, nullify_s;
-extern val number_s, numeq_s, numeric_error_s, oddp_s, oneplus_s;
-extern val op_s, optional_s, or_s, output_s, package_alist_s;
+extern val bstr_s, buf_d_s, buf_s, byte_oriented_k, cache_s;
+extern val call_s, car_s, carray_s, caseq_s, caseq_star_s;
+extern val caseql_s, caseql_star_s, casequal_s, casequal_star_s, cases_s;
+extern val cat_s, catch_s, cdb_s, cdigit_k, cdr_s;
+extern val ceil1_s, ceil_s, char_s, chars_k, choose_s;
+extern val chr_s, chset_s, circref_s, clear_error_s, close_s;
+extern val closure_s, cobj_s, coll_s, collect_each_s, collect_each_star_s;
+extern val collect_s, colon_k, compile_only_s, compl_s, compound_s;
+extern val cond_s, cons_s, continue_k, continue_s, cos_s;
+extern val counter_k, cptr_s, cset_s, cspace_k, ctime_k;
+extern val ctime_s, cword_char_k, data_s, day_s, decline_k;
+extern val defex_s, deffilter_s, define_s, defmacro_s, defparm_s;
+extern val defparml_s, defr_warning_s, defsymacro_s, defun_s, defvar_s;
+extern val defvarl_s, dev_k, dev_s, digit_k, div_s;
+extern val do_s, dohash_s, double_s, downcase_k, dst_s;
+extern val dvbind_s, dwim_s, each_op_s, each_s, each_star_s;
+extern val elif_s, else_s, empty_s, enum_s, enumed_s;
+extern val env_k, env_s, eof_s, eol_s, eq_s;
+extern val eql_based_k, eql_s, equal_based_k, equal_s, error_s;
+extern val eval_error_s, eval_only_s, evenp_s, exp_s, expr_s;
+extern val expt_s, exptmod_s, fail_s, fbind_s, fd_k;
+extern val ffi_call_desc_s, ffi_closure_s, ffi_type_s, file_error_s, fill_buf_s;
+extern val filter_k, filter_s, filters_s, finally_s, finish_k;
+extern val first_s, fixnum_s, flatten_s, flet_s, float_s;
+extern val floor1_s, floor_s, flush_s, for_op_s, for_s;
+extern val for_star_s, force_s, forget_s, form_k, format_s;
+extern val freeform_s, from_current_k, from_end_k, from_list_s, from_start_k;
+extern val frombase64_k, fromhtml_k, frompercent_k, fromurl_k, fun_k;
+extern val fun_s, fuzz_s, gap_k, gather_s, ge_s;
+extern val gen_s, generate_s, gensym_counter_s, get_byte_s, get_char_s;
+extern val get_error_s, get_error_str_s, get_fd_s, get_line_s, get_prop_s;
+extern val gid_k, gid_s, gmtoff_s, greedy_k, gt_s;
+extern val gun_s, hamt_node_s, hamt_s, handler_bind_s, hash_construct_s;
+extern val hash_iter_s, hash_lit_s, hash_s, hash_seed_s, hextoint_k;
+extern val hour_s, iapply_s, identity_s, if_s, iflet_s;
+extern val in_package_s, inc_s, include_s, init_k, ino_k;
+extern val ino_s, int16_s, int32_s, int64_s, int8_s;
+extern val int_s, integer_s, internal_error_s, into_k, intr_s;
+extern val inv_div_s, inv_minus_s, isqrt_s, keyword_package_s, labels_s;
+extern val lambda_s, lambda_set_s, last_s, lbind_s, lcons_s;
+extern val le_double_s, le_float_s, le_int16_s, le_int32_s, le_int64_s;
+extern val le_s, le_uint16_s, le_uint32_s, le_uint64_s, length_s;
+extern val let_s, let_star_s, lfilt_k, line_s, lines_k;
+extern val list_k, list_s, list_star_s, listener_greedy_eval_s, listener_hist_len_s;
+extern val listener_multi_line_p_s, listener_pprint_s, listener_sel_inclusive_p_s, lists_k, lit_s;
+extern val load_path_s, load_recursive_s, load_s, load_time_lit_s, load_time_s;
+extern val local_s, log10_s, log2_s, log_s, logand_s;
+extern val logcount_s, logior_s, lognot1_s, lognot_s, logtrunc_s;
+extern val logxor_s, long_s, longest_k, lstr_s, lt_s;
+extern val mac_param_bind_s, macro_s, macro_time_s, macrolet_s, make_struct_lit_s;
+extern val mandatory_k, maxgap_k, maxtimes_k, maybe_s, mdo_s;
+extern val memq_s, memql_s, memqual_s, merge_s, meth_s;
+extern val min_s, mingap_k, mintimes_k, minus_s, minusp_s;
+extern val mod_s, mod_s, mode_k, mode_s, modlast_s;
+extern val month_s, mtime_k, mtime_s, mul_s, name_k;
+extern val name_s, named_k, neg_s, next_s, next_spec_k;
+extern val nlink_k, nlink_s, none_s, nongreedy_s, not_s;
+extern val nothrow_k, noval_s, null_s, nullify_s, number_s;
+extern val numeq_s, numeric_error_s, oddp_s, oneplus_s, op_s;
+extern val optional_s, or_s, ordered_k, output_s, package_alist_s;
 extern val package_s, panic_s, parser_s, path_s, pkg_s;
 extern val plus_s, plusp_s, postinit_k, pprint_flo_format_s, print_base_s;
 extern val print_circle_s, print_flo_digits_s, print_flo_format_s, print_flo_precision_s, print_s;
@@ -183,65 +184,66 @@ val *protected_sym[] = {
   &be_uint16_s, &be_uint32_s, &be_uint64_s, &bignum_s, &bind_s,
   &bit_s, &bit_s, &blksize_k, &blksize_s, &block_s,
   &block_star_s, &blocks_k, &blocks_s, &bool_s, &bstr_d_s,
-  &bstr_s, &buf_d_s, &buf_s, &byte_oriented_k, &call_s,
-  &car_s, &carray_s, &caseq_s, &caseq_star_s, &caseql_s,
-  &caseql_star_s, &casequal_s, &casequal_star_s, &cases_s, &cat_s,
-  &catch_s, &cdigit_k, &cdr_s, &ceil1_s, &ceil_s,
-  &char_s, &chars_k, &choose_s, &chr_s, &chset_s,
-  &circref_s, &clear_error_s, &close_s, &closure_s, &cobj_s,
-  &coll_s, &collect_each_s, &collect_each_star_s, &collect_s, &colon_k,
-  &compile_only_s, &compl_s, &compound_s, &cond_s, &cons_s,
-  &continue_k, &continue_s, &cos_s, &counter_k, &cptr_s,
-  &cset_s, &cspace_k, &ctime_k, &ctime_s, &cword_char_k,
-  &data_s, &day_s, &decline_k, &defex_s, &deffilter_s,
-  &define_s, &defmacro_s, &defparm_s, &defparml_s, &defr_warning_s,
-  &defsymacro_s, &defun_s, &defvar_s, &defvarl_s, &dev_k,
-  &dev_s, &digit_k, &div_s, &do_s, &dohash_s,
-  &double_s, &downcase_k, &dst_s, &dvbind_s, &dwim_s,
-  &each_op_s, &each_s, &each_star_s, &elif_s, &else_s,
-  &empty_s, &enum_s, &enumed_s, &env_k, &env_s,
-  &eof_s, &eol_s, &eq_s, &eql_based_k, &eql_s,
-  &equal_based_k, &equal_s, &error_s, &eval_error_s, &eval_only_s,
-  &evenp_s, &exp_s, &expr_s, &expt_s, &exptmod_s,
-  &fail_s, &fbind_s, &fd_k, &ffi_call_desc_s, &ffi_closure_s,
-  &ffi_type_s, &file_error_s, &fill_buf_s, &filter_k, &filter_s,
-  &filters_s, &finally_s, &finish_k, &first_s, &fixnum_s,
-  &flatten_s, &flet_s, &float_s, &floor1_s, &floor_s,
-  &flush_s, &for_op_s, &for_s, &for_star_s, &force_s,
-  &forget_s, &form_k, &format_s, &freeform_s, &from_current_k,
-  &from_end_k, &from_list_s, &from_start_k, &frombase64_k, &fromhtml_k,
-  &frompercent_k, &fromurl_k, &fun_k, &fun_s, &fuzz_s,
-  &gap_k, &gather_s, &ge_s, &gen_s, &generate_s,
-  &gensym_counter_s, &get_byte_s, &get_char_s, &get_error_s, &get_error_str_s,
-  &get_fd_s, &get_line_s, &get_prop_s, &gid_k, &gid_s,
-  &gmtoff_s, &greedy_k, &gt_s, &gun_s, &handler_bind_s,
-  &hash_construct_s, &hash_iter_s, &hash_lit_s, &hash_s, &hash_seed_s,
-  &hextoint_k, &hour_s, &iapply_s, &identity_s, &if_s,
-  &iflet_s, &in_package_s, &inc_s, &include_s, &init_k,
-  &ino_k, &ino_s, &int16_s, &int32_s, &int64_s,
-  &int8_s, &int_s, &integer_s, &internal_error_s, &into_k,
-  &intr_s, &inv_div_s, &inv_minus_s, &isqrt_s, &keyword_package_s,
-  &labels_s, &lambda_s, &lambda_set_s, &last_s, &lbind_s,
-  &lcons_s, &le_double_s, &le_float_s, &le_int16_s, &le_int32_s,
-  &le_int64_s, &le_s, &le_uint16_s, &le_uint32_s, &le_uint64_s,
-  &length_s, &let_s, &let_star_s, &lfilt_k, &line_s,
-  &lines_k, &list_k, &list_s, &list_star_s, &listener_greedy_eval_s,
-  &listener_hist_len_s, &listener_multi_line_p_s, &listener_pprint_s, &listener_sel_inclusive_p_s, &lists_k,
-  &lit_s, &load_path_s, &load_recursive_s, &load_s, &load_time_lit_s,
-  &load_time_s, &local_s, &log10_s, &log2_s, &log_s,
-  &logand_s, &logcount_s, &logior_s, &lognot1_s, &lognot_s,
-  &logtrunc_s, &logxor_s, &long_s, &longest_k, &lstr_s,
-  &lt_s, &mac_param_bind_s, &macro_s, &macro_time_s, &macrolet_s,
-  &make_struct_lit_s, &mandatory_k, &maxgap_k, &maxtimes_k, &maybe_s,
-  &mdo_s, &memq_s, &memql_s, &memqual_s, &merge_s,
-  &meth_s, &min_s, &mingap_k, &mintimes_k, &minus_s,
-  &minusp_s, &mod_s, &mod_s, &mode_k, &mode_s,
-  &modlast_s, &month_s, &mtime_k, &mtime_s, &mul_s,
-  &name_k, &name_s, &named_k, &neg_s, &next_s,
-  &next_spec_k, &nlink_k, &nlink_s, &none_s, &nongreedy_s,
-  &not_s, &nothrow_k, &noval_s, &null_s, &nullify_s,
-  &number_s, &numeq_s, &numeric_error_s, &oddp_s, &oneplus_s,
-  &op_s, &optional_s, &or_s, &output_s, &package_alist_s,
+  &bstr_s, &buf_d_s, &buf_s, &byte_oriented_k, &cache_s,
+  &call_s, &car_s, &carray_s, &caseq_s, &caseq_star_s,
+  &caseql_s, &caseql_star_s, &casequal_s, &casequal_star_s, &cases_s,
+  &cat_s, &catch_s, &cdb_s, &cdigit_k, &cdr_s,
+  &ceil1_s, &ceil_s, &char_s, &chars_k, &choose_s,
+  &chr_s, &chset_s, &circref_s, &clear_error_s, &close_s,
+  &closure_s, &cobj_s, &coll_s, &collect_each_s, &collect_each_star_s,
+  &collect_s, &colon_k, &compile_only_s, &compl_s, &compound_s,
+  &cond_s, &cons_s, &continue_k, &continue_s, &cos_s,
+  &counter_k, &cptr_s, &cset_s, &cspace_k, &ctime_k,
+  &ctime_s, &cword_char_k, &data_s, &day_s, &decline_k,
+  &defex_s, &deffilter_s, &define_s, &defmacro_s, &defparm_s,
+  &defparml_s, &defr_warning_s, &defsymacro_s, &defun_s, &defvar_s,
+  &defvarl_s, &dev_k, &dev_s, &digit_k, &div_s,
+  &do_s, &dohash_s, &double_s, &downcase_k, &dst_s,
+  &dvbind_s, &dwim_s, &each_op_s, &each_s, &each_star_s,
+  &elif_s, &else_s, &empty_s, &enum_s, &enumed_s,
+  &env_k, &env_s, &eof_s, &eol_s, &eq_s,
+  &eql_based_k, &eql_s, &equal_based_k, &equal_s, &error_s,
+  &eval_error_s, &eval_only_s, &evenp_s, &exp_s, &expr_s,
+  &expt_s, &exptmod_s, &fail_s, &fbind_s, &fd_k,
+  &ffi_call_desc_s, &ffi_closure_s, &ffi_type_s, &file_error_s, &fill_buf_s,
+  &filter_k, &filter_s, &filters_s, &finally_s, &finish_k,
+  &first_s, &fixnum_s, &flatten_s, &flet_s, &float_s,
+  &floor1_s, &floor_s, &flush_s, &for_op_s, &for_s,
+  &for_star_s, &force_s, &forget_s, &form_k, &format_s,
+  &freeform_s, &from_current_k, &from_end_k, &from_list_s, &from_start_k,
+  &frombase64_k, &fromhtml_k, &frompercent_k, &fromurl_k, &fun_k,
+  &fun_s, &fuzz_s, &gap_k, &gather_s, &ge_s,
+  &gen_s, &generate_s, &gensym_counter_s, &get_byte_s, &get_char_s,
+  &get_error_s, &get_error_str_s, &get_fd_s, &get_line_s, &get_prop_s,
+  &gid_k, &gid_s, &gmtoff_s, &greedy_k, &gt_s,
+  &gun_s, &hamt_node_s, &hamt_s, &handler_bind_s, &hash_construct_s,
+  &hash_iter_s, &hash_lit_s, &hash_s, &hash_seed_s, &hextoint_k,
+  &hour_s, &iapply_s, &identity_s, &if_s, &iflet_s,
+  &in_package_s, &inc_s, &include_s, &init_k, &ino_k,
+  &ino_s, &int16_s, &int32_s, &int64_s, &int8_s,
+  &int_s, &integer_s, &internal_error_s, &into_k, &intr_s,
+  &inv_div_s, &inv_minus_s, &isqrt_s, &keyword_package_s, &labels_s,
+  &lambda_s, &lambda_set_s, &last_s, &lbind_s, &lcons_s,
+  &le_double_s, &le_float_s, &le_int16_s, &le_int32_s, &le_int64_s,
+  &le_s, &le_uint16_s, &le_uint32_s, &le_uint64_s, &length_s,
+  &let_s, &let_star_s, &lfilt_k, &line_s, &lines_k,
+  &list_k, &list_s, &list_star_s, &listener_greedy_eval_s, &listener_hist_len_s,
+  &listener_multi_line_p_s, &listener_pprint_s, &listener_sel_inclusive_p_s, &lists_k, &lit_s,
+  &load_path_s, &load_recursive_s, &load_s, &load_time_lit_s, &load_time_s,
+  &local_s, &log10_s, &log2_s, &log_s, &logand_s,
+  &logcount_s, &logior_s, &lognot1_s, &lognot_s, &logtrunc_s,
+  &logxor_s, &long_s, &longest_k, &lstr_s, &lt_s,
+  &mac_param_bind_s, &macro_s, &macro_time_s, &macrolet_s, &make_struct_lit_s,
+  &mandatory_k, &maxgap_k, &maxtimes_k, &maybe_s, &mdo_s,
+  &memq_s, &memql_s, &memqual_s, &merge_s, &meth_s,
+  &min_s, &mingap_k, &mintimes_k, &minus_s, &minusp_s,
+  &mod_s, &mod_s, &mode_k, &mode_s, &modlast_s,
+  &month_s, &mtime_k, &mtime_s, &mul_s, &name_k,
+  &name_s, &named_k, &neg_s, &next_s, &next_spec_k,
+  &nlink_k, &nlink_s, &none_s, &nongreedy_s, &not_s,
+  &nothrow_k, &noval_s, &null_s, &nullify_s, &number_s,
+  &numeq_s, &numeric_error_s, &oddp_s, &oneplus_s, &op_s,
+  &optional_s, &or_s, &ordered_k, &output_s, &package_alist_s,
   &package_s, &panic_s, &parser_s, &path_s, &pkg_s,
   &plus_s, &plusp_s, &postinit_k, &pprint_flo_format_s, &print_base_s,
   &print_circle_s, &print_flo_digits_s, &print_flo_format_s, &print_flo_precision_s, &print_s,
@@ -37,9 +37,15 @@ extern int debug_depth;
 #define EJ_DBG_REST(EJB)
 #endif
 
-#define EJ_OPT_MEMB EJ_DBG_MEMB
-#define EJ_OPT_SAVE(EJB) EJ_DBG_SAVE(EJB)
-#define EJ_OPT_REST(EJB) EJ_DBG_REST(EJB)
+struct prof_frame;
+extern struct prof_frame *prof_top;
+#define EJ_PROF_MEMB struct prof_frame *volatile prof;
+#define EJ_PROF_SAVE(EJB) (EJB).prof = prof_top,
+#define EJ_PROF_REST(EJB) prof_top = (EJB).prof,
+
+#define EJ_OPT_MEMB EJ_DBG_MEMB EJ_PROF_MEMB
+#define EJ_OPT_SAVE(EJB) EJ_DBG_SAVE(EJB) EJ_PROF_SAVE(EJB)
+#define EJ_OPT_REST(EJB) EJ_DBG_REST(EJB) EJ_PROF_REST(EJB)
 
 #if __i386__
 
@@ -148,6 +148,13 @@ static void help(void)
 "--compat=N             Synonym for -C N\n"
 "--gc-delta=N           Invoke garbage collection when malloc activity\n"
 "                       increments by N megabytes since last collection.\n"
+"--alloc-prof=N         Sample an allocation every N bytes, and print a\n"
+"                       report of the allocating functions at exit.\n"
+"--gc-pause-budget=N    Perform full garbage collections incrementally,\n"
+"                       pausing for at most about N microseconds at a time.\n"
+"                       Implies --gc-mark-bitmap.\n"
+"--gc-heap-slack=N      Keep completely free heaps amounting to N percent\n"
+"                       of the heaps in use, releasing the rest to the system.\n"
 "--args...              Allows multiple arguments to be encoded as a single\n"
 "                       argument. This is useful in hash-bang scripting.\n"
 "                       Peculiar syntax. See manual.\n"
@@ -162,6 +169,13 @@ static void help(void)
 "--debug-expansion      Allow debugger to step through macro-expansion of query.\n"
 "--yydebug              Debug Yacc parser, if compiled with YYDEBUG support.\n"
 "--gc-debug             Enable a garbage collector stress test (slow).\n"
+"--gc-log               Print a line describing each garbage collection\n"
+"                       on standard error.\n"
+"--gc-lazy-sweep        Sweep the heaps incrementally during allocation\n"
+"                       rather than at the end of each full collection.\n"
+"                       Implies --gc-mark-bitmap.\n"
+"--gc-mark-bitmap       Keep garbage collector mark bits outside of objects,\n"
+"                       so that collection doesn't write to mature objects.\n"
 "--vg-debug             Enable Valgrind integration, if compiled in.\n"
 "--dv-regex             Handle all regexes using derivative-based back-end.\n"
 "\n"
@@ -447,6 +461,44 @@ static int gc_delta(val optval)
   return 1;
 }
 
+static int gc_pause_budget(val optval)
+{
+  if (minusp(optval)) {
+    format(std_error, lit("~a: option --gc-pause-budget needs a "
+                          "nonnegative argument\n"), prog_string, nao);
+    return 0;
+  }
+
+  opt_gc_pause_budget = c_unum(optval);
+  if (opt_gc_pause_budget != 0)
+    gc_set_mark_bitmap(1);
+  return 1;
+}
+
+static int gc_heap_slack(val optval)
+{
+  opt_gc_heap_slack = c_num(optval);
+  return 1;
+}
+
+static void alloc_prof_exit(void)
+{
+  gc_prof_report(std_error, nil);
+}
+
+static int alloc_prof(val optval)
+{
+  if (!plusp(optval)) {
+    format(std_error, lit("~a: option --alloc-prof needs a "
+                          "positive argument\n"), prog_string, nao);
+    return 0;
+  }
+
+  alloc_prof_period = c_unum(optval);
+  atexit(alloc_prof_exit);
+  return 1;
+}
+
 static void free_all(void)
 {
   static int called;
@@ -649,7 +701,25 @@ int txr_main(int argc, char **argv)
 
       /* Long opts with arguments */
       if (equal(opt, lit("gc-delta"))) {
-        if (!do_fixnum_opt(gc_delta, opt, arg))
+        if (!do_fixnum_opt(gc_delta, opt, org))
+          return EXIT_FAILURE;
+        continue;
+      }
+
+      if (equal(opt, lit("alloc-prof"))) {
+        if (!do_fixnum_opt(alloc_prof, opt, org))
+          return EXIT_FAILURE;
+        continue;
+      }
+
+      if (equal(opt, lit("gc-pause-budget"))) {
+        if (!do_fixnum_opt(gc_pause_budget, opt, org))
+          return EXIT_FAILURE;
+        continue;
+      }
+
+      if (equal(opt, lit("gc-heap-slack"))) {
+        if (!do_fixnum_opt(gc_heap_slack, opt, org))
           return EXIT_FAILURE;
         continue;
       }
@@ -691,6 +761,16 @@ int txr_main(int argc, char **argv)
         drop_privilege();
         opt_gc_debug = 1;
         continue;
+      } else if (equal(opt, lit("gc-log"))) {
+        opt_gc_log = 1;
+        continue;
+      } else if (equal(opt, lit("gc-lazy-sweep"))) {
+        opt_gc_lazy_sweep = 1;
+        gc_set_mark_bitmap(1);
+        continue;
+      } else if (equal(opt, lit("gc-mark-bitmap"))) {
+        gc_set_mark_bitmap(1);
+        continue;
       } else if (equal(opt, lit("vg-debug"))) {
         drop_privilege();
 #if HAVE_VALGRIND
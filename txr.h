@@ -30,6 +30,10 @@ extern int opt_print_bindings;
 extern int opt_lisp_bindings;
 extern int opt_arraydims;
 extern int opt_gc_debug;
+extern int opt_gc_lazy_sweep;
+extern int opt_gc_log;
+extern ucnum opt_gc_pause_budget;
+extern cnum opt_gc_heap_slack;
 #if HAVE_VALGRIND
 extern int opt_vg_debug;
 #endif
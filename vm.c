@@ -89,6 +89,7 @@ struct vm {
   unsigned ip;
   vm_word_t *code;
   struct vm_env *dspl;
+  struct prof_frame pf;
 };
 
 struct vm_closure {
@@ -337,8 +338,12 @@ static void vm_reset(struct vm *vm, struct vm_desc *vd,
   vm->ip = start_ip;
   vm->code = vd->code;
   vm->dspl = dspl;
+  vm->pf.fun = nil;
+  vm->pf.code = vd->self;
+  vm->pf.ip = start_ip;
 }
 
+#define VM_NOPS 64
 #define vm_insn_opcode(insn) convert(vm_op_t, ((insn) >> 26))
 #define vm_insn_operand(insn) ((insn) & 0xFFFFU)
 #define vm_insn_extra(insn) (((insn) >> 16) & 0x3FF)
@@ -355,6 +360,7 @@ static void vm_reset(struct vm *vm, struct vm_desc *vd,
 #define vm_sm_idx(arg) ((arg) & VM_SM_LEV_MASK)
 
 static val vm_execute(struct vm *vm);
+static val vm_run(struct vm *vm);
 
 INLINE val vm_get(struct vm_env *dspl, unsigned ref)
 {
@@ -466,15 +472,100 @@ NOINLINE static val vm_fin(struct vm *vm, vm_word_t insn)
   return vm_get(vm->dspl, vm_insn_operand(insn));
 }
 
+#define vm_funcall_common \
+  val closure = fun->f.env;                                                  \
+  val desc = fun->f.f.vm_desc;                                               \
+  struct vm_desc *vd = vm_desc_struct(self, desc);                           \
+  struct vm_closure *vc = coerce(struct vm_closure *, closure->co.handle);   \
+  struct vm vm;                                                              \
+  val *frame = coerce(val *, alloca(sizeof *frame * vd->frsz));              \
+  struct vm_env *dspl = coerce(struct vm_env *, frame + vd->nreg);           \
+  vm_reset(&vm, vd, dspl, vc->nlvl - 1, vc->ip);                             \
+  vm.pf.fun = fun;                                                           \
+  vm.dspl = coerce(struct vm_env *, frame + vd->nreg);                       \
+  frame[0] = nil;                                                            \
+  vm.dspl[0].mem = frame;                                                    \
+  vm.dspl[0].vec = nil;                                                      \
+  vm.dspl[1].mem = vd->data;                                                 \
+  vm.dspl[1].vec = vd->datavec;                                              \
+  memcpy(vm.dspl + 2, vc->dspl + 2, (vc->nlvl - 2) * sizeof *vm.dspl);       \
+  if (vc->frsz != 0) {                                                       \
+    vm.lev++;                                                                \
+    vm.dspl[vm.lev].mem = coerce(val *, zalloca(vc->frsz * sizeof (val *))); \
+    vm.dspl[vm.lev].vec = num_fast(vc->frsz);                                \
+  }
+
+/*
+ * A call from VM code to a VM function whose fixed parameters can receive
+ * the arguments directly: no variadic parameter, and enough arguments for
+ * the required ones. Missing optional arguments are passed as the colon
+ * keyword, as generic_funcall does.
+ */
+INLINE int vm_direct_p(val fun, unsigned nargs)
+{
+  return (type(fun) == FUN && fun->f.functype == FVM && !fun->f.variadic &&
+          nargs <= convert(unsigned, fun->f.fixparam) &&
+          nargs >= convert(unsigned, fun->f.fixparam - fun->f.optargs));
+}
+
+/*
+ * Move the arguments from the caller's registers straight into the
+ * callee's parameter registers, bypassing the argument vector and
+ * generic_funcall. The caller's argument words begin with the high half of
+ * argw; the callee's parameter words are at the closure's entry point.
+ */
+NOINLINE static val vm_call_direct(struct vm *caller, val fun,
+                                   unsigned nargs, vm_word_t argw)
+{
+  val self = lit("vm-call");
+  unsigned fixparam = fun->f.fixparam;
+  unsigned i;
+  vm_word_t parmw = 0;
+  vm_funcall_common;
+
+  for (i = 0; i < fixparam; i++) {
+    val arg = colon_k;
+
+    if (i < nargs) {
+      unsigned areg;
+
+      if (i % 2 == 0) {
+        areg = vm_arg_operand_hi(argw);
+      } else {
+        argw = caller->code[caller->ip++];
+        areg = vm_arg_operand_lo(argw);
+      }
+
+      arg = vm_getz(caller->dspl, areg);
+    }
+
+    if (i % 2 == 0) {
+      parmw = vm.code[vm.ip++];
+      vm_set(dspl, vm_arg_operand_lo(parmw), arg);
+    } else {
+      vm_set(dspl, vm_arg_operand_hi(parmw), arg);
+    }
+  }
+
+  return vm_run(&vm);
+}
+
 NOINLINE static void vm_call(struct vm *vm, vm_word_t insn)
 {
   unsigned nargs = vm_insn_extra(insn);
   unsigned dest = vm_insn_operand(insn);
   vm_word_t argw = vm->code[vm->ip++];
   unsigned fun = vm_arg_operand_lo(argw);
+  val fobj = vm_get(vm->dspl, fun);
   val result;
   args_decl (args, max(nargs, ARGS_MIN));
 
+  if (vm_direct_p(fobj, nargs)) {
+    result = vm_call_direct(vm, fobj, nargs, argw);
+    vm_set(vm->dspl, dest, result);
+    return;
+  }
+
   if (nargs--) {
     args_add(args, vm_get(vm->dspl, vm_arg_operand_hi(argw)));
 
@@ -563,6 +654,12 @@ NOINLINE static void vm_gcall(struct vm *vm, vm_word_t insn)
   val fun = deref(vm_stab(vm, funidx, lookup_fun, lit("function")));
   val result;
 
+  if (vm_direct_p(fun, nargs)) {
+    result = vm_call_direct(vm, fun, nargs, argw);
+    vm_set(vm->dspl, dest, result);
+    return;
+  }
+
   switch (nargs) {
   case 0:
     result = funcall(fun);
@@ -657,26 +754,26 @@ NOINLINE static void vm_gapply(struct vm *vm, vm_word_t insn)
   vm_set(vm->dspl, dest, result);
 }
 
-NOINLINE static void vm_movrs(struct vm *vm, vm_word_t insn)
+INLINE void vm_movrs(struct vm *vm, vm_word_t insn)
 {
   val datum = vm_sm_get(vm->dspl, vm_insn_extra(insn));
   vm_set(vm->dspl, vm_insn_operand(insn), datum);
 }
 
-NOINLINE static void vm_movsr(struct vm *vm, vm_word_t insn)
+INLINE void vm_movsr(struct vm *vm, vm_word_t insn)
 {
   val datum = vm_get(vm->dspl, vm_insn_operand(insn));
   vm_sm_set(vm->dspl, vm_insn_extra(insn), datum);
 }
 
-NOINLINE static void vm_movrr(struct vm *vm, vm_word_t insn)
+INLINE void vm_movrr(struct vm *vm, vm_word_t insn)
 {
   vm_word_t arg = vm->code[vm->ip++];
   val datum = vm_get(vm->dspl, vm_arg_operand_lo(arg));
   vm_set(vm->dspl, vm_insn_operand(insn), datum);
 }
 
-NOINLINE static void vm_movrsi(struct vm *vm, vm_word_t insn)
+INLINE void vm_movrsi(struct vm *vm, vm_word_t insn)
 {
   unsigned dst = vm_insn_operand(insn);
   ucnum negmask = ~convert(ucnum, 0x3FF);
@@ -688,7 +785,7 @@ NOINLINE static void vm_movrsi(struct vm *vm, vm_word_t insn)
   vm_set(vm->dspl, dst, coerce(val, imm));
 }
 
-NOINLINE static void vm_movsmi(struct vm *vm, vm_word_t insn)
+INLINE void vm_movsmi(struct vm *vm, vm_word_t insn)
 {
   unsigned dst = vm_insn_extra(insn);
   ucnum negmask = ~convert(ucnum, 0xFFFF);
@@ -700,7 +797,7 @@ NOINLINE static void vm_movsmi(struct vm *vm, vm_word_t insn)
   vm_sm_set(vm->dspl, dst, coerce(val, imm));
 }
 
-NOINLINE static void vm_movrbi(struct vm *vm, vm_word_t insn)
+INLINE void vm_movrbi(struct vm *vm, vm_word_t insn)
 {
   unsigned dst = vm_insn_operand(insn);
   ucnum negmask = ~convert(ucnum, 0xFFFFFFFF);
@@ -712,12 +809,12 @@ NOINLINE static void vm_movrbi(struct vm *vm, vm_word_t insn)
   vm_set(vm->dspl, dst, coerce(val, imm));
 }
 
-static void vm_jmp(struct vm *vm, vm_word_t insn)
+INLINE void vm_jmp(struct vm *vm, vm_word_t insn)
 {
   vm->ip = vm_insn_bigop(insn);
 }
 
-NOINLINE static void vm_if(struct vm *vm, vm_word_t insn)
+INLINE void vm_if(struct vm *vm, vm_word_t insn)
 {
   unsigned ip = vm_insn_bigop(insn);
   vm_word_t arg = vm->code[vm->ip++];
@@ -727,7 +824,7 @@ NOINLINE static void vm_if(struct vm *vm, vm_word_t insn)
     vm->ip = vm_insn_bigop(ip);
 }
 
-NOINLINE static void vm_ifq(struct vm *vm, vm_word_t insn)
+INLINE void vm_ifq(struct vm *vm, vm_word_t insn)
 {
   unsigned ip = vm_insn_bigop(insn);
   vm_word_t arg = vm->code[vm->ip++];
@@ -738,7 +835,7 @@ NOINLINE static void vm_ifq(struct vm *vm, vm_word_t insn)
     vm->ip = vm_insn_bigop(ip);
 }
 
-NOINLINE static void vm_ifql(struct vm *vm, vm_word_t insn)
+INLINE void vm_ifql(struct vm *vm, vm_word_t insn)
 {
   unsigned ip = vm_insn_bigop(insn);
   vm_word_t arg = vm->code[vm->ip++];
@@ -946,24 +1043,126 @@ NOINLINE static void vm_bindv(struct vm *vm, vm_word_t insn)
   env_vbind(dyn_env, sym, vm_get(vm->dspl, src));
 }
 
-NOINLINE static void vm_gettab(struct vm *vm, vm_word_t insn,
-                               val (*lookup_fn)(val env, val sym),
-                               val kind_str)
+INLINE void vm_gettab(struct vm *vm, vm_word_t insn,
+                      val (*lookup_fn)(val env, val sym),
+                      val kind_str)
 {
   unsigned idx = vm_insn_operand(insn);
   unsigned dst = vm_insn_extra(insn);
   vm_sm_set(vm->dspl, dst, deref(vm_stab(vm, idx, lookup_fn, kind_str)));
 }
 
-NOINLINE static void vm_settab(struct vm *vm, vm_word_t insn,
-                               val (*lookup_fn)(val env, val sym),
-                               val kind_str)
+INLINE void vm_settab(struct vm *vm, vm_word_t insn,
+                      val (*lookup_fn)(val env, val sym),
+                      val kind_str)
 {
   unsigned idx = vm_insn_operand(insn);
   unsigned src = vm_insn_extra(insn);
   set(vm_stab(vm, idx, lookup_fn, kind_str), vm_sm_get(vm->dspl, src));
 }
 
+INLINE void vm_add(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  if (is_num(a) && is_num(b)) {
+    cnum sum = c_n(a) + c_n(b);
+    if (sum >= NUM_MIN && sum <= NUM_MAX) {
+      vm_set(vm->dspl, vm_insn_operand(insn), num_fast(sum));
+      return;
+    }
+  }
+
+  vm_set(vm->dspl, vm_insn_operand(insn), plus(a, b));
+}
+
+INLINE void vm_sub(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  if (is_num(a) && is_num(b)) {
+    cnum diff = c_n(a) - c_n(b);
+    if (diff >= NUM_MIN && diff <= NUM_MAX) {
+      vm_set(vm->dspl, vm_insn_operand(insn), num_fast(diff));
+      return;
+    }
+  }
+
+  vm_set(vm->dspl, vm_insn_operand(insn), minus(a, b));
+}
+
+INLINE void vm_numeq(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_num(a) && is_num(b), tnil(a == b), numeq(a, b)));
+}
+
+INLINE void vm_numlt(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_num(a) && is_num(b), tnil(c_n(a) < c_n(b)), lt(a, b)));
+}
+
+INLINE void vm_numgt(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_num(a) && is_num(b), tnil(c_n(a) > c_n(b)), gt(a, b)));
+}
+
+INLINE void vm_numle(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_num(a) && is_num(b), tnil(c_n(a) <= c_n(b)), le(a, b)));
+}
+
+INLINE void vm_numge(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val a = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+  val b = vm_get(vm->dspl, vm_arg_operand_hi(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_num(a) && is_num(b), tnil(c_n(a) >= c_n(b)), ge(a, b)));
+}
+
+INLINE void vm_car(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val obj = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_ptr(obj) && obj->t.type == CONS, obj->c.car, car(obj)));
+}
+
+INLINE void vm_cdr(struct vm *vm, vm_word_t insn)
+{
+  vm_word_t arg = vm->code[vm->ip++];
+  val obj = vm_get(vm->dspl, vm_arg_operand_lo(arg));
+
+  vm_set(vm->dspl, vm_insn_operand(insn),
+         if3(is_ptr(obj) && obj->t.type == CONS, obj->c.cdr, cdr(obj)));
+}
+
 NOINLINE static void vm_close(struct vm *vm, vm_word_t insn)
 {
   unsigned dst = vm_insn_bigop(insn);
@@ -982,145 +1181,295 @@ NOINLINE static void vm_close(struct vm *vm, vm_word_t insn)
   vm->ip = dst;
 }
 
+#if CONFIG_VM_PAIR_STATS
+static ucnum vm_pair_count[VM_NOPS][VM_NOPS];
+static unsigned vm_prev_op;
+
+#define vm_count_pair(op) \
+  (vm_pair_count[vm_prev_op][op]++, vm_prev_op = (op))
+#else
+#define vm_count_pair(op) ((void) 0)
+#endif
+
+/*
+ * With computed goto, each handler ends with its own fetch and indirect
+ * jump, rather than all of them sharing the one at the top of the switch,
+ * so that the branch predictor can learn what follows each opcode.
+ * VM_OP labels a handler for either dispatch method; VM_NEXT ends it.
+ */
+#if HAVE_COMPUTED_GOTO
+#define VM_OP(op) case op: vm_op_ ## op
+#define VM_NEXT                                 \
+  do {                                          \
+    insn = vm->code[vm->ip++];                  \
+    opcode = vm_insn_opcode(insn);              \
+    vm_count_pair(opcode);                      \
+    goto *vm_op_label[opcode];                  \
+  } while (0)
+#else
+#define VM_OP(op) case op
+#define VM_NEXT break
+#endif
+
+/*
+ * The first instruction of a superinstruction has been recoded by the
+ * assembler; the second is intact. The fused handler executes the
+ * second instruction directly, provided that it is indeed next.
+ */
+#define vm_fused(op, handler)                   \
+  do {                                          \
+    vm_word_t next = vm->code[vm->ip];          \
+    if (vm_insn_opcode(next) == (op)) {         \
+      vm->ip++;                                 \
+      vm_count_pair(op);                        \
+      handler(vm, next);                        \
+    }                                           \
+  } while (0)
+
 NOINLINE static val vm_execute(struct vm *vm)
 {
+  vm_word_t insn;
+  vm_op_t opcode;
+#if HAVE_COMPUTED_GOTO
+  /* Indexed by opcode; unassigned opcodes are invalid. */
+  static void *const vm_op_label[VM_NOPS] = {
+    &&vm_op_NOOP, &&vm_op_FRAME, &&vm_op_SFRAME, &&vm_op_DFRAME, &&vm_op_END,
+    &&vm_op_FIN, &&vm_op_PROF, &&vm_op_CALL, &&vm_op_APPLY, &&vm_op_GCALL,
+    &&vm_op_GAPPLY, &&vm_op_MOVRS, &&vm_op_MOVSR, &&vm_op_MOVRR,
+    &&vm_op_MOVRSI, &&vm_op_MOVSMI, &&vm_op_MOVRBI, &&vm_op_JMP, &&vm_op_IF,
+    &&vm_op_IFQ, &&vm_op_IFQL, &&vm_op_SWTCH, &&vm_op_UWPROT, &&vm_op_BLOCK,
+    &&vm_op_RETSR, &&vm_op_RETRS, &&vm_op_RETRR, &&vm_op_ABSCSR,
+    &&vm_op_CATCH, &&vm_op_HANDLE, &&vm_op_GETV, &&vm_op_OLDGETF,
+    &&vm_op_GETL1, &&vm_op_GETVB, &&vm_op_GETFB, &&vm_op_GETL1B,
+    &&vm_op_SETV, &&vm_op_SETL1, &&vm_op_BINDV, &&vm_op_CLOSE, &&vm_op_GETLX,
+    &&vm_op_SETLX, &&vm_op_GETF, &&vm_op_MOVRSIGCALL, &&vm_op_MOVSRJMP,
+    &&vm_op_GCALLIF, &&vm_op_GCALLGCALL, &&vm_op_IFGCALL, &&vm_op_ADD,
+    &&vm_op_SUB, &&vm_op_NUMEQ, &&vm_op_NUMLT, &&vm_op_NUMGT, &&vm_op_NUMLE,
+    &&vm_op_NUMGE, &&vm_op_CAR, &&vm_op_CDR, &&vm_op_invalid,
+    &&vm_op_invalid, &&vm_op_invalid, &&vm_op_invalid, &&vm_op_invalid,
+    &&vm_op_invalid, &&vm_op_invalid
+  };
+#endif
+
   for (;;) {
-    vm_word_t insn = vm->code[vm->ip++];
-    vm_op_t opcode = vm_insn_opcode(insn);
+    insn = vm->code[vm->ip++];
+    opcode = vm_insn_opcode(insn);
+    vm_count_pair(opcode);
 
     switch (opcode) {
-    case NOOP:
-      break;
-    case FRAME:
+    VM_OP(NOOP):
+      VM_NEXT;
+    VM_OP(FRAME):
       vm_frame(vm, insn);
-      break;
-    case SFRAME:
+      VM_NEXT;
+    VM_OP(SFRAME):
       vm_sframe(vm, insn);
-      break;
-    case DFRAME:
+      VM_NEXT;
+    VM_OP(DFRAME):
       vm_dframe(vm, insn);
-      break;
-    case END:
+      VM_NEXT;
+    VM_OP(END):
       return vm_end(vm, insn);
-    case FIN:
+    VM_OP(FIN):
       return vm_fin(vm, insn);
-    case PROF:
+    VM_OP(PROF):
       vm_prof(vm, insn);
-      break;
-    case CALL:
+      VM_NEXT;
+    VM_OP(CALL):
       vm_call(vm, insn);
-      break;
-    case APPLY:
+      VM_NEXT;
+    VM_OP(APPLY):
       vm_apply(vm, insn);
-      break;
-    case GCALL:
+      VM_NEXT;
+    VM_OP(GCALL):
       vm_gcall(vm, insn);
-      break;
-    case GAPPLY:
+      VM_NEXT;
+    VM_OP(GAPPLY):
       vm_gapply(vm, insn);
-      break;
-    case MOVRS:
+      VM_NEXT;
+    VM_OP(MOVRS):
       vm_movrs(vm, insn);
-      break;
-    case MOVSR:
+      VM_NEXT;
+    VM_OP(MOVSR):
       vm_movsr(vm, insn);
-      break;
-    case MOVRR:
+      VM_NEXT;
+    VM_OP(MOVRR):
       vm_movrr(vm, insn);
-      break;
-    case MOVRSI:
+      VM_NEXT;
+    VM_OP(MOVRSI):
       vm_movrsi(vm, insn);
-      break;
-    case MOVSMI:
+      VM_NEXT;
+    VM_OP(MOVSMI):
       vm_movsmi(vm, insn);
-      break;
-    case MOVRBI:
+      VM_NEXT;
+    VM_OP(MOVRBI):
       vm_movrbi(vm, insn);
-      break;
-    case JMP:
+      VM_NEXT;
+    VM_OP(JMP):
       vm_jmp(vm, insn);
-      break;
-    case IF:
+      VM_NEXT;
+    VM_OP(IF):
       vm_if(vm, insn);
-      break;
-    case IFQ:
+      VM_NEXT;
+    VM_OP(IFQ):
       vm_ifq(vm, insn);
-      break;
-    case IFQL:
+      VM_NEXT;
+    VM_OP(IFQL):
       vm_ifql(vm, insn);
-      break;
-    case SWTCH:
+      VM_NEXT;
+    VM_OP(SWTCH):
       vm_swtch(vm, insn);
-      break;
-    case UWPROT:
+      VM_NEXT;
+    VM_OP(UWPROT):
       vm_uwprot(vm, insn);
-      break;
-    case BLOCK:
+      VM_NEXT;
+    VM_OP(BLOCK):
       vm_block(vm, insn);
-      break;
-    case RETSR:
+      VM_NEXT;
+    VM_OP(RETSR):
       vm_retsr(vm, insn);
-      break;
-    case RETRS:
+      VM_NEXT;
+    VM_OP(RETRS):
       vm_retrs(vm, insn);
-      break;
-    case RETRR:
+      VM_NEXT;
+    VM_OP(RETRR):
       vm_retrr(vm, insn);
-      break;
-    case ABSCSR:
+      VM_NEXT;
+    VM_OP(ABSCSR):
       vm_abscsr(vm, insn);
-      break;
-    case CATCH:
+      VM_NEXT;
+    VM_OP(CATCH):
       vm_catch(vm, insn);
-      break;
-    case HANDLE:
+      VM_NEXT;
+    VM_OP(HANDLE):
       vm_handle(vm, insn);
-      break;
-    case GETV:
+      VM_NEXT;
+    VM_OP(GETV):
       vm_getsym(vm, insn, lookup_var, lit("variable"));
-      break;
-    case OLDGETF:
+      VM_NEXT;
+    VM_OP(OLDGETF):
       vm_getsym(vm, insn, lookup_fun, lit("function"));
-      break;
-    case GETL1:
+      VM_NEXT;
+    VM_OP(GETL1):
       vm_getsym(vm, insn, lookup_sym_lisp1, lit("variable/function"));
-      break;
-    case GETVB:
+      VM_NEXT;
+    VM_OP(GETVB):
       vm_getbind(vm, insn, lookup_var, lit("variable"));
-      break;
-    case GETFB:
+      VM_NEXT;
+    VM_OP(GETFB):
       vm_getbind(vm, insn, lookup_fun, lit("function"));
-      break;
-    case GETL1B:
+      VM_NEXT;
+    VM_OP(GETL1B):
       vm_getbind(vm, insn, lookup_sym_lisp1, lit("variable/function"));
-      break;
-    case SETV:
+      VM_NEXT;
+    VM_OP(SETV):
       vm_setsym(vm, insn, lookup_var, lit("variable"));
-      break;
-    case SETL1:
+      VM_NEXT;
+    VM_OP(SETL1):
       vm_setsym(vm, insn, lookup_sym_lisp1, lit("variable/function"));
-      break;
-    case BINDV:
+      VM_NEXT;
+    VM_OP(BINDV):
       vm_bindv(vm, insn);
-      break;
-    case CLOSE:
+      VM_NEXT;
+    VM_OP(CLOSE):
       vm_close(vm, insn);
-      break;
-    case GETLX:
+      VM_NEXT;
+    VM_OP(GETLX):
       vm_gettab(vm, insn, lookup_var, lit("variable"));
-      break;
-    case SETLX:
+      VM_NEXT;
+    VM_OP(SETLX):
       vm_settab(vm, insn, lookup_var, lit("variable"));
-      break;
-    case GETF:
+      VM_NEXT;
+    VM_OP(GETF):
       vm_gettab(vm, insn, lookup_fun, lit("function"));
-      break;
+      VM_NEXT;
+    VM_OP(MOVRSIGCALL):
+      vm_movrsi(vm, insn);
+      vm_fused(GCALL, vm_gcall);
+      VM_NEXT;
+    VM_OP(MOVSRJMP):
+      vm_movsr(vm, insn);
+      vm_fused(JMP, vm_jmp);
+      VM_NEXT;
+    VM_OP(GCALLIF):
+      vm_gcall(vm, insn);
+      vm_fused(IF, vm_if);
+      VM_NEXT;
+    VM_OP(GCALLGCALL):
+      vm_gcall(vm, insn);
+      vm_fused(GCALL, vm_gcall);
+      VM_NEXT;
+    VM_OP(IFGCALL):
+      vm_if(vm, insn);
+      vm_fused(GCALL, vm_gcall);
+      VM_NEXT;
+    VM_OP(ADD):
+      vm_add(vm, insn);
+      VM_NEXT;
+    VM_OP(SUB):
+      vm_sub(vm, insn);
+      VM_NEXT;
+    VM_OP(NUMEQ):
+      vm_numeq(vm, insn);
+      VM_NEXT;
+    VM_OP(NUMLT):
+      vm_numlt(vm, insn);
+      VM_NEXT;
+    VM_OP(NUMGT):
+      vm_numgt(vm, insn);
+      VM_NEXT;
+    VM_OP(NUMLE):
+      vm_numle(vm, insn);
+      VM_NEXT;
+    VM_OP(NUMGE):
+      vm_numge(vm, insn);
+      VM_NEXT;
+    VM_OP(CAR):
+      vm_car(vm, insn);
+      VM_NEXT;
+    VM_OP(CDR):
+      vm_cdr(vm, insn);
+      VM_NEXT;
     default:
+#if HAVE_COMPUTED_GOTO
+    vm_op_invalid:
+#endif
       uw_throwf(error_s, lit("invalid opcode ~s"), num_fast(opcode), nao);
     }
   }
 }
 
+#if CONFIG_VM_PAIR_STATS
+static val vm_pair_stats(val reset)
+{
+  list_collect_decl (out, ptail);
+  int i, j;
+
+  for (i = 0; i < VM_NOPS; i++) {
+    for (j = 0; j < VM_NOPS; j++) {
+      if (vm_pair_count[i][j]) {
+        val pair = cons(num_fast(i), num_fast(j));
+        ptail = list_collect(ptail, cons(pair, unum(vm_pair_count[i][j])));
+        if (default_null_arg(reset))
+          vm_pair_count[i][j] = 0;
+      }
+    }
+  }
+
+  return out;
+}
+#endif
+
+static val vm_run(struct vm *vm)
+{
+  val ret;
+  vm->pf.up = prof_top;
+  prof_top = &vm->pf;
+  ret = vm_execute(vm);
+  prof_frame_pop(&vm->pf);
+  return ret;
+}
+
 val vm_execute_toplevel(val desc)
 {
   val self = lit("vm-execute-toplevel");
@@ -1141,7 +1490,7 @@ val vm_execute_toplevel(val desc)
   vm.dspl[1].mem = vd->data;
   vm.dspl[1].vec = vd->datavec;
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 val vm_execute_closure(val fun, struct args *args)
@@ -1162,6 +1511,7 @@ val vm_execute_closure(val fun, struct args *args)
 
   vm_reset(&vm, vd, dspl, vc->nlvl - 1, vc->ip);
 
+  vm.pf.fun = fun;
   vm.dspl = coerce(struct vm_env *, frame + vd->nreg);
 
   frame[0] = nil;
@@ -1207,37 +1557,15 @@ val vm_execute_closure(val fun, struct args *args)
     vm_set(dspl, vreg, z(vargs));
   }
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
-#define vm_funcall_common \
-  val closure = fun->f.env;                                                  \
-  val desc = fun->f.f.vm_desc;                                               \
-  struct vm_desc *vd = vm_desc_struct(self, desc);                           \
-  struct vm_closure *vc = coerce(struct vm_closure *, closure->co.handle);   \
-  struct vm vm;                                                              \
-  val *frame = coerce(val *, alloca(sizeof *frame * vd->frsz));              \
-  struct vm_env *dspl = coerce(struct vm_env *, frame + vd->nreg);           \
-  vm_reset(&vm, vd, dspl, vc->nlvl - 1, vc->ip);                             \
-  vm.dspl = coerce(struct vm_env *, frame + vd->nreg);                       \
-  frame[0] = nil;                                                            \
-  vm.dspl[0].mem = frame;                                                    \
-  vm.dspl[0].vec = nil;                                                      \
-  vm.dspl[1].mem = vd->data;                                                 \
-  vm.dspl[1].vec = vd->datavec;                                              \
-  memcpy(vm.dspl + 2, vc->dspl + 2, (vc->nlvl - 2) * sizeof *vm.dspl);       \
-  if (vc->frsz != 0) {                                                       \
-    vm.lev++;                                                                \
-    vm.dspl[vm.lev].mem = coerce(val *, zalloca(vc->frsz * sizeof (val *))); \
-    vm.dspl[vm.lev].vec = num_fast(vc->frsz);                                \
-  }
-
 val vm_funcall(val fun)
 {
   val self = lit("vm-funcall");
   vm_funcall_common;
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 val vm_funcall1(val fun, val arg)
@@ -1251,7 +1579,7 @@ val vm_funcall1(val fun, val arg)
     vm_set(dspl, areg, arg);
   }
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 val vm_funcall2(val fun, val arg1, val arg2)
@@ -1267,7 +1595,7 @@ val vm_funcall2(val fun, val arg1, val arg2)
     vm_set(dspl, a2reg, arg2);
   }
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 val vm_funcall3(val fun, val arg1, val arg2, val arg3)
@@ -1286,7 +1614,7 @@ val vm_funcall3(val fun, val arg1, val arg2, val arg3)
     vm_set(dspl, a3reg, arg3);
   }
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 val vm_funcall4(val fun, val arg1, val arg2, val arg3, val arg4)
@@ -1307,7 +1635,7 @@ val vm_funcall4(val fun, val arg1, val arg2, val arg3, val arg4)
     vm_set(dspl, a4reg, arg4);
   }
 
-  return vm_execute(&vm);
+  return vm_run(&vm);
 }
 
 static val vm_closure_desc(val closure)
@@ -1367,4 +1695,7 @@ void vm_init(void)
   reg_fun(intern(lit("vm-execute-toplevel"), system_package), func_n1(vm_execute_toplevel));
   reg_fun(intern(lit("vm-closure-desc"), system_package), func_n1(vm_closure_desc));
   reg_fun(intern(lit("vm-closure-entry"), system_package), func_n1(vm_closure_entry));
+#if CONFIG_VM_PAIR_STATS
+  reg_fun(intern(lit("vm-pair-stats"), system_package), func_n1o(vm_pair_stats, 0));
+#endif
 }
@@ -69,4 +69,18 @@ typedef enum vm_op {
   GETLX = 40,
   SETLX = 41,
   GETF = 42,
+  MOVRSIGCALL = 43,
+  MOVSRJMP = 44,
+  GCALLIF = 45,
+  GCALLGCALL = 46,
+  IFGCALL = 47,
+  ADD = 48,
+  SUB = 49,
+  NUMEQ = 50,
+  NUMLT = 51,
+  NUMGT = 52,
+  NUMLE = 53,
+  NUMGE = 54,
+  CAR = 55,
+  CDR = 56,
 } vm_op_t;